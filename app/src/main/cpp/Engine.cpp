@@ -16,45 +16,291 @@
 
 #include "Engine.h"
 
+#include <pthread.h>
+
+#include <cerrno>
+#include <chrono>
+
 #include "Utils.h"
 
+Engine::Engine()
+      : mHasWindow(false),
+        mFramePending(false),
+        mWindowGeneration(0),
+        mRenderer(&mProfiler, &mScreenshotWriter, &mFrameRecorder, &mResourceTracker),
+        mIsRendererReady(false) {
+    ASSERT(sem_init(&mEventSemaphore, 0, 0) == 0);
+    ASSERT(sem_init(&mTermSemaphore, 0, 0) == 0);
+    mRenderThread = std::thread(&Engine::renderLoop, this);
+}
+
+Engine::~Engine() {
+    postEvent(Event(Event::Type::kQuit));
+    mRenderThread.join();
+    sem_destroy(&mTermSemaphore);
+    sem_destroy(&mEventSemaphore);
+}
+
 bool Engine::isReady() {
-    std::lock_guard<std::mutex> lock(mLock);
-    return mIsRendererReady;
+    return mHasWindow.load(std::memory_order_relaxed);
 }
 
-void Engine::drawFrame() {
-    std::lock_guard<std::mutex> lock(mLock);
-    if (mIsRendererReady) {
-        mRenderer.drawFrame();
+void Engine::requestFrame() {
+    // Coalesce with the frame request the render thread hasn't picked up yet
+    if (!mFramePending.exchange(true)) {
+        postEvent(Event(Event::Type::kFrame));
     }
 }
 
 void Engine::onInitWindow(ANativeWindow* window, AAssetManager* assetManager) {
     ALOGD("%s", __FUNCTION__);
-    std::lock_guard<std::mutex> lock(mLock);
-    mRenderer.initialize(window, assetManager);
-    mIsRendererReady = true;
+    Event event(Event::Type::kInitWindow);
+    event.window = window;
+    event.assetManager = assetManager;
+    postEvent(event);
+    mWindowGeneration++;
+    mPacer.reset();
+    mHasWindow = true;
 }
 
 void Engine::onWindowResized(uint32_t width, uint32_t height) {
     ALOGD("%s", __FUNCTION__);
-    std::lock_guard<std::mutex> lock(mLock);
-    if (mIsRendererReady) {
-        mRenderer.updateSurface(width, height);
-    }
+    Event event(Event::Type::kResizeWindow);
+    event.width = width;
+    event.height = height;
+    postCoalescedEvent(event);
 }
 
 void Engine::onTermWindow() {
     ALOGD("%s", __FUNCTION__);
-    std::lock_guard<std::mutex> lock(mLock);
+    mHasWindow = false;
+    postEvent(Event(Event::Type::kTermWindow));
+
+    // The window is gone once we return, so wait until the render thread has let go of it
+    while (sem_wait(&mTermSemaphore) != 0 && errno == EINTR) {
+    }
+}
+
+uint32_t Engine::getDelayMillis(int64_t frameTimeNanos) {
+    return mPacer.getDelayMillis(frameTimeNanos);
+}
+
+void Engine::setTargetFrameRate(uint32_t framesPerSecond) {
+    mPacer.setTargetFrameRate(framesPerSecond);
+}
+
+FramePacer::Stats Engine::getPacingStats() {
+    return mPacer.getStats();
+}
+
+FrameProfiler::Summary Engine::getFrameTimings(FrameProfiler::Stage stage) {
+    return mProfiler.getSummary(stage);
+}
+
+void Engine::setLatencyProfile(Renderer::LatencyProfile profile) {
+    ALOGD("%s: %d", __FUNCTION__, static_cast<int>(profile));
+    Event event(Event::Type::kSetLatencyProfile);
+    event.latencyProfile = profile;
+    postCoalescedEvent(event);
+}
+
+void Engine::setIdleFrameSkipping(bool enabled, uint32_t forcedFrameInterval) {
+    ALOGD("%s: %d, %u", __FUNCTION__, enabled, forcedFrameInterval);
+    Event event(Event::Type::kSetIdleFrameSkipping);
+    event.skipIdleFrames = enabled;
+    event.forcedFrameInterval = forcedFrameInterval;
+    postCoalescedEvent(event);
+}
+
+void Engine::setReadbackPolicy(Renderer::ReadbackPolicy policy, uint32_t interval) {
+    ALOGD("%s: %d, %u", __FUNCTION__, static_cast<int>(policy), interval);
+    Event event(Event::Type::kSetReadbackPolicy);
+    event.readbackPolicy = policy;
+    event.readbackInterval = interval;
+    postCoalescedEvent(event);
+}
+
+void Engine::requestReadback() {
+    postCoalescedEvent(Event(Event::Type::kRequestReadback));
+}
+
+void Engine::setScreenshotDirectory(const std::string& directory) {
+    ALOGD("%s: %s", __FUNCTION__, directory.c_str());
+    mScreenshotWriter.setDirectory(directory);
+}
+
+void Engine::requestScreenshot() {
+    postCoalescedEvent(Event(Event::Type::kRequestScreenshot));
+}
+
+void Engine::setFrameVerification(bool enabled, uint8_t tolerance) {
+    ALOGD("%s: %d, %u", __FUNCTION__, enabled, tolerance);
+    Event event(Event::Type::kSetFrameVerification);
+    event.verifyFrames = enabled;
+    event.verificationTolerance = tolerance;
+    postCoalescedEvent(event);
+}
+
+void Engine::startRecording(std::unique_ptr<FrameSink> sink, YuvFormat format) {
+    ALOGD("%s: %d", __FUNCTION__, static_cast<int>(format));
+    Event event(Event::Type::kStartRecording);
+    event.sink = sink.release();
+    event.yuvFormat = format;
+    postCoalescedEvent(event);
+}
+
+void Engine::stopRecording() {
+    // Replaces a start that wasn't picked up yet, the renderer also stops the previous recording
+    // when starting one
+    postCoalescedEvent(Event(Event::Type::kStopRecording));
+}
+
+FrameRecorder::Stats Engine::getRecordingStats() {
+    return mFrameRecorder.getStats();
+}
+
+ResourceTracker::Stats Engine::getResourceStats() {
+    return mResourceTracker.getStats();
+}
+
+void Engine::postEvent(const Event& event) {
+    // Bounded by kMaxQueuedEvents, see postCoalescedEvent
+    ASSERT(mEvents.push(event));
+    sem_post(&mEventSemaphore);
+}
+
+void Engine::postCoalescedEvent(const Event& event) {
+    Event marker(event.type);
+    {
+        std::lock_guard<std::mutex> lock(mCoalescingMutex);
+        CoalescingSlot& slot = mCoalescingSlots[getCoalescingSlot(event.type)];
+        // The sink of a recording that never started is ours to release
+        if (slot.isQueued && slot.event.type == Event::Type::kStartRecording) {
+            delete slot.event.sink;
+        }
+        slot.event = event;
+        if (slot.isQueued && slot.windowGeneration == mWindowGeneration) {
+            return;
+        }
+        slot.sequence++;
+        slot.windowGeneration = mWindowGeneration;
+        slot.isQueued = true;
+        marker.sequence = slot.sequence;
+    }
+    postEvent(marker);
+}
+
+bool Engine::takeCoalescedEvent(Event* inOutEvent) {
+    std::lock_guard<std::mutex> lock(mCoalescingMutex);
+    CoalescingSlot& slot = mCoalescingSlots[getCoalescingSlot(inOutEvent->type)];
+    if (!slot.isQueued || inOutEvent->sequence != slot.sequence) {
+        return false;
+    }
+    *inOutEvent = slot.event;
+    slot.isQueued = false;
+    return true;
+}
+
+bool Engine::isCoalesced(Event::Type type) {
+    return type != Event::Type::kInitWindow && type != Event::Type::kTermWindow &&
+            type != Event::Type::kFrame && type != Event::Type::kQuit;
+}
+
+uint32_t Engine::getCoalescingSlot(Event::Type type) {
+    if (type == Event::Type::kStopRecording) {
+        type = Event::Type::kStartRecording;
+    }
+    return static_cast<uint32_t>(type);
+}
+
+void Engine::renderLoop() {
+    pthread_setname_np(pthread_self(), "RenderThread");
+
+    bool quit = false;
+    while (!quit) {
+        if (sem_wait(&mEventSemaphore) != 0) {
+            ASSERT(errno == EINTR);
+            continue;
+        }
+
+        // Drain all pending events before rendering the frame
+        bool hasFrame = false;
+        Event event;
+        while (mEvents.pop(&event)) {
+            if (isCoalesced(event.type) && !takeCoalescedEvent(&event)) {
+                continue;
+            }
+            switch (event.type) {
+                case Event::Type::kInitWindow:
+                    mProfiler.reset();
+                    mRenderer.initialize(event.window, event.assetManager);
+                    mIsRendererReady = true;
+                    break;
+                case Event::Type::kResizeWindow:
+                    if (mIsRendererReady) {
+                        mRenderer.updateSurface(event.width, event.height);
+                    }
+                    break;
+                case Event::Type::kTermWindow:
+                    if (mIsRendererReady) {
+                        mRenderer.destroy();
+                        mIsRendererReady = false;
+                    }
+                    hasFrame = false;
+                    sem_post(&mTermSemaphore);
+                    break;
+                case Event::Type::kSetLatencyProfile:
+                    // Kept across windows, so it also applies to a renderer initialized later
+                    mRenderer.setLatencyProfile(event.latencyProfile);
+                    break;
+                case Event::Type::kSetIdleFrameSkipping:
+                    mRenderer.setIdleFrameSkipping(event.skipIdleFrames,
+                                                   event.forcedFrameInterval);
+                    break;
+                case Event::Type::kSetReadbackPolicy:
+                    mRenderer.setReadbackPolicy(event.readbackPolicy, event.readbackInterval);
+                    break;
+                case Event::Type::kRequestReadback:
+                    mRenderer.requestReadback();
+                    break;
+                case Event::Type::kRequestScreenshot:
+                    mRenderer.requestScreenshot();
+                    break;
+                case Event::Type::kSetFrameVerification:
+                    mRenderer.setFrameVerification(event.verifyFrames,
+                                                   event.verificationTolerance);
+                    break;
+                case Event::Type::kStartRecording:
+                    // Also works before the window exists, the renderer stops it once destroyed
+                    mRenderer.startRecording(std::unique_ptr<FrameSink>(event.sink),
+                                             event.yuvFormat);
+                    break;
+                case Event::Type::kStopRecording:
+                    mRenderer.stopRecording();
+                    break;
+                case Event::Type::kFrame:
+                    mFramePending = false;
+                    hasFrame = true;
+                    break;
+                case Event::Type::kQuit:
+                    quit = true;
+                    break;
+            }
+        }
+
+        if (hasFrame && mIsRendererReady && !quit) {
+            const auto start = std::chrono::steady_clock::now();
+            // Skipped frames cost next to nothing and would skew the pacing
+            if (mRenderer.drawFrame()) {
+                const auto cost = std::chrono::steady_clock::now() - start;
+                mPacer.onFrameCost(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(cost).count());
+            }
+        }
+    }
+
     if (mIsRendererReady) {
         mRenderer.destroy();
         mIsRendererReady = false;
     }
 }
-
-uint32_t Engine::getDelayMillis(int64_t /*frameTimeNanos*/) {
-    // we can play around with frameTimeNanos to add more dynamic callback delay control
-    return kDelayMillis;
-}
@@ -17,27 +17,175 @@
 #pragma once
 
 #include <android_native_app_glue.h>
+#include <semaphore.h>
 
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <thread>
 
+#include "FramePacer.h"
+#include "FrameProfiler.h"
+#include "FrameRecorder.h"
 #include "Renderer.h"
+#include "ResourceTracker.h"
+#include "ScreenshotWriter.h"
+#include "SpscQueue.h"
 
+// Engine owns a dedicated render thread. All public APIs are called from the looper thread, which
+// is the only producer of the event queue drained by the render thread between frames.
 class Engine {
+private:
+    struct Event {
+        enum class Type {
+            kInitWindow,
+            kResizeWindow,
+            kTermWindow,
+            kSetLatencyProfile,
+            kSetIdleFrameSkipping,
+            kSetReadbackPolicy,
+            kRequestReadback,
+            kRequestScreenshot,
+            kSetFrameVerification,
+            kStartRecording,
+            kStopRecording,
+            kFrame,
+            kQuit,
+        };
+
+        Type type;
+        ANativeWindow* window;
+        AAssetManager* assetManager;
+        uint32_t width;
+        uint32_t height;
+        Renderer::LatencyProfile latencyProfile;
+        bool skipIdleFrames;
+        uint32_t forcedFrameInterval;
+        Renderer::ReadbackPolicy readbackPolicy;
+        uint32_t readbackInterval;
+        bool verifyFrames;
+        uint8_t verificationTolerance;
+        // Owned by the event until the render thread hands it to the renderer
+        FrameSink* sink;
+        YuvFormat yuvFormat;
+        // Tells a coalesced event's marker in the queue apart from the markers it replaced
+        uint32_t sequence;
+
+        explicit Event(Type eventType = Type::kFrame)
+              : type(eventType),
+                window(nullptr),
+                assetManager(nullptr),
+                width(0),
+                height(0),
+                latencyProfile(Renderer::LatencyProfile::kBalanced),
+                skipIdleFrames(false),
+                forcedFrameInterval(0),
+                readbackPolicy(Renderer::ReadbackPolicy::kNever),
+                readbackInterval(0),
+                verifyFrames(false),
+                verificationTolerance(0),
+                sink(nullptr),
+                yuvFormat(YuvFormat::kNv12),
+                sequence(0) {}
+    };
+
+    // The latest event of a coalesced type, see postCoalescedEvent
+    struct CoalescingSlot {
+        Event event;
+        // Of the latest marker queued for the slot
+        uint32_t sequence;
+        // mWindowGeneration when the latest marker was queued
+        uint32_t windowGeneration;
+        bool isQueued;
+
+        explicit CoalescingSlot() : sequence(0), windowGeneration(0), isQueued(false) {}
+    };
+
+    static constexpr const uint32_t kEventTypeCount = static_cast<uint32_t>(Event::Type::kQuit) + 1;
+    // Start and stop recording share a slot
+    static constexpr const uint32_t kCoalescingSlotCount = 8;
+    // Queued at most: one frame event, the window and quit events, as onTermWindow waits for the
+    // queue to drain, and a marker per slot on either side of a window being initialized
+    static constexpr const uint32_t kMaxQueuedEvents = 1 + 3 + 2 * kCoalescingSlotCount;
+    static constexpr const uint32_t kEventQueueSize = 32;
+    static_assert(kMaxQueuedEvents <= kEventQueueSize, "The event queue can fill up");
+
 public:
-    explicit Engine() : mIsRendererReady(false) {}
+    explicit Engine();
+    ~Engine();
     bool isReady();
-    void drawFrame();
+    void requestFrame();
     void onInitWindow(ANativeWindow* window, AAssetManager* assetManager);
     void onWindowResized(uint32_t width, uint32_t height);
     void onTermWindow();
     uint32_t getDelayMillis(int64_t frameTimeNanos);
+    // e.g. 30, 45, 60, 90 or 120, snapped to a multiple of the display period. 0 for display rate
+    void setTargetFrameRate(uint32_t framesPerSecond);
+    FramePacer::Stats getPacingStats();
+    // Percentiles over the most recent frames, reset when a new window is initialized
+    FrameProfiler::Summary getFrameTimings(FrameProfiler::Stage stage);
+    void setLatencyProfile(Renderer::LatencyProfile profile);
+    // Skips frames whose content wouldn't change, see Renderer::setIdleFrameSkipping
+    void setIdleFrameSkipping(bool enabled, uint32_t forcedFrameInterval);
+    void setReadbackPolicy(Renderer::ReadbackPolicy policy, uint32_t interval);
+    void requestReadback();
+    // PNGs are written to the directory on a background thread, see ScreenshotWriter
+    void setScreenshotDirectory(const std::string& directory);
+    // Captures the next rendered frame, un-rotated to how it appears on the display
+    void requestScreenshot();
+    // Compares every rendered frame with the expected image, mismatches are logged by the renderer
+    void setFrameVerification(bool enabled, uint8_t tolerance);
+    // Feeds every rendered frame to the sink as YUV until stopped, see FrameRecorder. Also stops
+    // when the window is terminated.
+    void startRecording(std::unique_ptr<FrameSink> sink, YuvFormat format);
+    void stopRecording();
+    FrameRecorder::Stats getRecordingStats();
+    // Live and peak counts of the Vulkan objects of the renderer, and its device memory against the
+    // budget of each heap. The budget is refreshed every few hundred frames.
+    ResourceTracker::Stats getResourceStats();
 
 private:
-    // mLock protects all members below
-    std::mutex mLock;
+    void postEvent(const Event& event);
+    // For settings and requests where only the latest one matters. The event is kept in its slot
+    // and only a marker is queued, unless one already is. The render thread applies the slot when
+    // it gets to the marker, so the queue stays bounded however often these are posted.
+    void postCoalescedEvent(const Event& event);
+    // Replaces a marker with the latest event of its slot, false for a marker that was superseded
+    bool takeCoalescedEvent(Event* inOutEvent);
+    static bool isCoalesced(Event::Type type);
+    static uint32_t getCoalescingSlot(Event::Type type);
+    void renderLoop();
+
+    // Written by the looper thread only, tells whether frames should be requested
+    std::atomic<bool> mHasWindow;
+    // At most one kFrame event is queued at a time, so control events always find room
+    std::atomic<bool> mFramePending;
+    // Fed with Choreographer timestamps on the looper thread and frame costs on the render thread
+    FramePacer mPacer;
+    // Written by the render thread, read by any thread
+    FrameProfiler mProfiler;
+    // Fed with captures by the render thread, configured from any thread
+    ScreenshotWriter mScreenshotWriter;
+    // Fed with recorded frames by the render thread, its stats are read by any thread
+    FrameRecorder mFrameRecorder;
+    // Written by the render thread, read by any thread
+    ResourceTracker mResourceTracker;
+
+    // Single producer (looper thread), single consumer (render thread)
+    SpscQueue<Event, kEventQueueSize> mEvents;
+    // Guards the slots, accessed by the looper thread and the render thread
+    std::mutex mCoalescingMutex;
+    CoalescingSlot mCoalescingSlots[kEventTypeCount];
+    // Bumped by the looper thread for each window initialized. A marker queued before that is
+    // superseded rather than reused, so the latest event is applied to the new window.
+    uint32_t mWindowGeneration;
+    // Counts posted events, so the render thread can sleep while the queue is empty
+    sem_t mEventSemaphore;
+    // Signaled by the render thread once a kTermWindow event has been handled
+    sem_t mTermSemaphore;
+    std::thread mRenderThread;
+
+    // Members below are only accessed on the render thread
     Renderer mRenderer;
     bool mIsRendererReady;
-
-    // defer 13ms to target 60Hz on a 60Hz display or 45Hz on a 90Hz display
-    static constexpr const uint32_t kDelayMillis = 13;
 };
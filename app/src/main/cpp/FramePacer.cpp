@@ -0,0 +1,168 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FramePacer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+
+#include "Utils.h"
+
+int64_t FramePacer::getMedian(const int64_t* samples, uint32_t count) {
+    ASSERT(count && count <= kHistorySize);
+    int64_t sorted[kHistorySize];
+    std::copy(samples, samples + count, sorted);
+    std::nth_element(sorted, sorted + count / 2, sorted + count);
+    return sorted[count / 2];
+}
+
+static int64_t getNowNanos() {
+    // steady_clock is CLOCK_MONOTONIC, the same clock as the Choreographer frame time
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+void FramePacer::setTargetFrameRate(uint32_t framesPerSecond) {
+    ALOGD("%s: %u", __FUNCTION__, framesPerSecond);
+    mTargetFrameRate = framesPerSecond;
+}
+
+void FramePacer::reset() {
+    mLastFrameTimeNanos = 0;
+    mScheduledVsyncs = 0;
+}
+
+void FramePacer::onFrameCost(int64_t costNanos) {
+    mLastFrameCostNanos.store(costNanos, std::memory_order_relaxed);
+}
+
+uint32_t FramePacer::getDelayMillis(int64_t frameTimeNanos) {
+    if (mLastFrameTimeNanos != 0) {
+        recordVsyncDelta(frameTimeNanos - mLastFrameTimeNanos);
+    }
+    mLastFrameTimeNanos = frameTimeNanos;
+
+    // Pick up the cost of the frame requested by the previous callback
+    const int64_t costNanos = mLastFrameCostNanos.exchange(0, std::memory_order_relaxed);
+    if (costNanos > 0) {
+        mFrameCosts[mFrameCostCount++ % kHistorySize] = costNanos;
+        if (mStats.frameIntervalNanos && costNanos > mStats.frameIntervalNanos) {
+            mStats.overBudgetFrames++;
+        }
+    }
+    if (++mStats.frameCount % kLogInterval == 0) {
+        ALOGD("%s: interval[%lldns] missed[%llu] skipped[%llu] overBudget[%llu]", __FUNCTION__,
+              (long long)mStats.frameIntervalNanos, (unsigned long long)mStats.missedDeadlines,
+              (unsigned long long)mStats.skippedVsyncs,
+              (unsigned long long)mStats.overBudgetFrames);
+    }
+
+    // Take a callback on every vsync until the display period is known
+    if (!mIsCalibrated) {
+        mScheduledVsyncs = 1;
+        mStats.frameIntervalNanos = mDisplayPeriodNanos;
+        return 0;
+    }
+
+    const int64_t period = mDisplayPeriodNanos;
+    mScheduledVsyncs = getVsyncsPerFrame();
+    mStats.frameIntervalNanos = mScheduledVsyncs * period;
+
+    // The callback fires on the first vsync after the delay. Aim half a period ahead of the target
+    // vsync, so timestamp jitter can't make it land one vsync early or late, and render as soon as
+    // that vsync arrives for minimal latency.
+    const int64_t elapsedNanos = getNowNanos() - frameTimeNanos;
+    const int64_t delayNanos = (mScheduledVsyncs - 1) * period + period / 2 - elapsedNanos;
+    return delayNanos > 0 ? static_cast<uint32_t>(delayNanos / kNanosPerMilli) : 0;
+}
+
+FramePacer::Stats FramePacer::getStats() const {
+    Stats stats = mStats;
+    stats.displayPeriodNanos = mDisplayPeriodNanos;
+    return stats;
+}
+
+void FramePacer::recordVsyncDelta(int64_t deltaNanos) {
+    if (deltaNanos <= 0) {
+        return;
+    }
+
+    if (!mIsCalibrated) {
+        // Every vsync takes a callback while calibrating, so the median delta is the display period
+        // even if the looper thread was too busy for a few of them
+        mPeriodSamples[mPeriodSampleCount++ % kHistorySize] = deltaNanos;
+        if (mPeriodSampleCount >= kMinPeriodSamples) {
+            mDisplayPeriodNanos =
+                    getMedian(mPeriodSamples, std::min(mPeriodSampleCount, kHistorySize));
+            mIsCalibrated = true;
+            mOutlierCount = 0;
+            ALOGD("%s: display period = %lldns", __FUNCTION__, (long long)mDisplayPeriodNanos);
+        }
+        return;
+    }
+
+    const int64_t period = mDisplayPeriodNanos;
+    const int64_t vsyncs = (deltaNanos + period / 2) / period;
+    const int64_t errorNanos = deltaNanos - vsyncs * period;
+    if (vsyncs == 0 || std::abs(errorNanos) > period / 4) {
+        // Timestamps stopped lining up with the learned period, e.g. the display switched its
+        // refresh rate, so learn it again
+        if (++mOutlierCount >= kMaxOutliers) {
+            recalibrate();
+        }
+        return;
+    }
+    mOutlierCount = 0;
+
+    if (mScheduledVsyncs && vsyncs > mScheduledVsyncs) {
+        mStats.missedDeadlines++;
+        mStats.skippedVsyncs += vsyncs - mScheduledVsyncs;
+    }
+
+    // Slowly track drift of the display period
+    mDisplayPeriodNanos += (deltaNanos / vsyncs - period) / 8;
+}
+
+void FramePacer::recalibrate() {
+    ALOGD("%s", __FUNCTION__);
+    mIsCalibrated = false;
+    mPeriodSampleCount = 0;
+    mOutlierCount = 0;
+}
+
+int64_t FramePacer::getFrameCostNanos() const {
+    if (!mFrameCostCount) {
+        return 0;
+    }
+    return getMedian(mFrameCosts, std::min(mFrameCostCount, kHistorySize));
+}
+
+uint32_t FramePacer::getVsyncsPerFrame() const {
+    const int64_t period = mDisplayPeriodNanos;
+
+    int64_t vsyncs = 1;
+    if (mTargetFrameRate) {
+        const int64_t targetIntervalNanos = kNanosPerSecond / mTargetFrameRate;
+        vsyncs = std::max<int64_t>(1, (targetIntervalNanos + period / 2) / period);
+    }
+
+    // A frame that can't be produced within the interval only queues up behind the previous ones,
+    // so fall back to the smallest multiple of the display period that fits the recent frame cost
+    const int64_t costVsyncs = (getFrameCostNanos() + period - 1) / period;
+    return static_cast<uint32_t>(std::max(vsyncs, costVsyncs));
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// FramePacer decides how long to defer the next Choreographer callback. It learns the display
+// period from the Choreographer timestamps, then schedules frames on a multiple of that period to
+// hit the target frame rate, backing off to a lower multiple when frames take longer than that.
+//
+// All APIs are called from the looper thread, except onFrameCost which the render thread calls.
+class FramePacer {
+public:
+    struct Stats {
+        uint64_t frameCount;
+        // Callbacks that arrived at least one vsync later than scheduled
+        uint64_t missedDeadlines;
+        // Total number of vsyncs lost by those late callbacks
+        uint64_t skippedVsyncs;
+        // Frames whose CPU cost exceeded the frame interval they were scheduled for
+        uint64_t overBudgetFrames;
+        int64_t displayPeriodNanos;
+        int64_t frameIntervalNanos;
+    };
+
+    explicit FramePacer() {}
+    // 0 means to render at the display refresh rate
+    void setTargetFrameRate(uint32_t framesPerSecond);
+    // Forget the last callback timestamp, e.g. when callbacks stop while there is no window
+    void reset();
+    void onFrameCost(int64_t costNanos);
+    uint32_t getDelayMillis(int64_t frameTimeNanos);
+    Stats getStats() const;
+
+private:
+    void recordVsyncDelta(int64_t deltaNanos);
+    void recalibrate();
+    int64_t getFrameCostNanos() const;
+    uint32_t getVsyncsPerFrame() const;
+    static int64_t getMedian(const int64_t* samples, uint32_t count);
+
+    static constexpr const uint32_t kHistorySize = 32;
+    static constexpr const uint32_t kMinPeriodSamples = 8;
+    static constexpr const uint32_t kMaxOutliers = 4;
+    static constexpr const uint32_t kDefaultFrameRate = 60;
+    static constexpr const uint32_t kLogInterval = 100;
+    static constexpr const int64_t kDefaultDisplayPeriodNanos = 16666667;
+    static constexpr const int64_t kNanosPerSecond = 1000000000;
+    static constexpr const int64_t kNanosPerMilli = 1000000;
+
+    uint32_t mTargetFrameRate = kDefaultFrameRate;
+    int64_t mLastFrameTimeNanos = 0;
+
+    // Display period learned from consecutive vsync callbacks in calibration mode
+    bool mIsCalibrated = false;
+    int64_t mDisplayPeriodNanos = kDefaultDisplayPeriodNanos;
+    int64_t mPeriodSamples[kHistorySize] = {};
+    uint32_t mPeriodSampleCount = 0;
+    uint32_t mOutlierCount = 0;
+
+    // CPU cost of recent frames, reported by the render thread
+    std::atomic<int64_t> mLastFrameCostNanos{0};
+    int64_t mFrameCosts[kHistorySize] = {};
+    uint32_t mFrameCostCount = 0;
+
+    // Number of vsyncs the pending callback was scheduled to wait for
+    uint32_t mScheduledVsyncs = 0;
+
+    Stats mStats = {};
+};
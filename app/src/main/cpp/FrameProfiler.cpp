@@ -0,0 +1,110 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FrameProfiler.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "Utils.h"
+
+void FrameProfiler::addSample(Stage stage, int64_t nanos) {
+    const uint32_t index = static_cast<uint32_t>(stage);
+    ASSERT(index < kStageCount);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mSamples[index][mSampleCounts[index]++ % kHistorySize] = nanos;
+}
+
+FrameProfiler::Summary FrameProfiler::getSummary(Stage stage) const {
+    const uint32_t index = static_cast<uint32_t>(stage);
+    ASSERT(index < kStageCount);
+
+    // Sort a copy outside the lock, so the render thread is never blocked on it
+    int64_t sorted[kHistorySize];
+    uint32_t count;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        count = static_cast<uint32_t>(std::min<uint64_t>(mSampleCounts[index], kHistorySize));
+        std::copy(mSamples[index], mSamples[index] + count, sorted);
+    }
+
+    Summary summary = {};
+    summary.sampleCount = count;
+    if (count == 0) {
+        return summary;
+    }
+
+    std::sort(sorted, sorted + count);
+    // Nearest-rank percentiles
+    auto getPercentile = [&](uint32_t percent) {
+        const uint32_t rank = (count * percent + 99) / 100;
+        return sorted[rank ? rank - 1 : 0];
+    };
+    summary.p50Nanos = getPercentile(50);
+    summary.p95Nanos = getPercentile(95);
+    summary.p99Nanos = getPercentile(99);
+    summary.maxNanos = sorted[count - 1];
+    return summary;
+}
+
+void FrameProfiler::reset() {
+    std::lock_guard<std::mutex> lock(mLock);
+    std::fill(mSampleCounts, mSampleCounts + kStageCount, 0);
+}
+
+void FrameProfiler::logSummaries() const {
+    for (uint32_t i = 0; i < kStageCount; i++) {
+        const Stage stage = static_cast<Stage>(i);
+        const Summary summary = getSummary(stage);
+        if (summary.sampleCount == 0) {
+            continue;
+        }
+        ALOGD("%s: %-16s p50[%lldns] p95[%lldns] p99[%lldns] max[%lldns]", __FUNCTION__,
+              getStageName(stage), (long long)summary.p50Nanos, (long long)summary.p95Nanos,
+              (long long)summary.p99Nanos, (long long)summary.maxNanos);
+    }
+}
+
+const char* FrameProfiler::getStageName(Stage stage) {
+    switch (stage) {
+        case Stage::kFenceWait:
+            return "FenceWait";
+        case Stage::kAcquire:
+            return "Acquire";
+        case Stage::kRecord:
+            return "Record";
+        case Stage::kSubmit:
+            return "Submit";
+        case Stage::kReadback:
+            return "Readback";
+        case Stage::kPresent:
+            return "Present";
+        case Stage::kGpuRenderPass:
+            return "GpuRenderPass";
+        case Stage::kGpuReadbackCopy:
+            return "GpuReadbackCopy";
+        default:
+            break;
+    }
+    return "Unknown";
+}
+
+int64_t FrameProfiler::getNowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
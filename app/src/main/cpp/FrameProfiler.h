@@ -0,0 +1,63 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+
+// FrameProfiler keeps the most recent samples of every frame stage in a fixed-size ring and
+// summarizes them as percentiles. The render thread adds samples, any thread can read summaries.
+class FrameProfiler {
+public:
+    enum class Stage {
+        // CPU time spent in Renderer::drawFrame
+        kFenceWait,
+        kAcquire,
+        kRecord,
+        kSubmit,
+        kReadback,
+        kPresent,
+        // GPU time measured with timestamp queries
+        kGpuRenderPass,
+        kGpuReadbackCopy,
+        kCount,
+    };
+
+    struct Summary {
+        uint32_t sampleCount;
+        int64_t p50Nanos;
+        int64_t p95Nanos;
+        int64_t p99Nanos;
+        int64_t maxNanos;
+    };
+
+    explicit FrameProfiler() {}
+    void addSample(Stage stage, int64_t nanos);
+    Summary getSummary(Stage stage) const;
+    void reset();
+    void logSummaries() const;
+    static const char* getStageName(Stage stage);
+    static int64_t getNowNanos();
+
+private:
+    static constexpr const uint32_t kStageCount = static_cast<uint32_t>(Stage::kCount);
+    static constexpr const uint32_t kHistorySize = 256;
+
+    mutable std::mutex mLock;
+    int64_t mSamples[kStageCount][kHistorySize] = {};
+    uint64_t mSampleCounts[kStageCount] = {};
+};
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FrameRecorder.h"
+
+#include "Utils.h"
+
+FrameRecorder::FrameRecorder() {
+    for (auto& isSlotBusy : mIsSlotBusy) {
+        isSlotBusy = false;
+    }
+    mThread = std::thread(&FrameRecorder::recorderLoop, this);
+}
+
+FrameRecorder::~FrameRecorder() {
+    stop();
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mQuit = true;
+    }
+    mWorkCondition.notify_one();
+    mThread.join();
+}
+
+void FrameRecorder::start(std::unique_ptr<FrameSink> sink) {
+    ASSERT(sink);
+    stop();
+    mRecordedFrameCount = 0;
+    mDroppedFrameCount = 0;
+    mSink = std::move(sink);
+}
+
+void FrameRecorder::stop() {
+    if (!mSink) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        mIdleCondition.wait(lock, [this] { return mFrames.empty() && !mIsSinkBusy; });
+    }
+    mSink->onStop();
+    mSink.reset();
+    ALOGD("%s: recorded[%u] dropped[%u]", __FUNCTION__, mRecordedFrameCount.load(),
+          mDroppedFrameCount.load());
+}
+
+int32_t FrameRecorder::acquireSlot() {
+    for (uint32_t i = 0; i < kSlotCount; i++) {
+        bool isBusy = false;
+        if (mIsSlotBusy[i].compare_exchange_strong(isBusy, true, std::memory_order_acquire)) {
+            return static_cast<int32_t>(i);
+        }
+    }
+    mDroppedFrameCount++;
+    return -1;
+}
+
+void FrameRecorder::dropSlot(uint32_t slot) {
+    ASSERT(slot < kSlotCount && mIsSlotBusy[slot]);
+    mIsSlotBusy[slot].store(false, std::memory_order_release);
+    mDroppedFrameCount++;
+}
+
+void FrameRecorder::submit(uint32_t slot, const RecordedFrame& frame) {
+    ASSERT(slot < kSlotCount && mIsSlotBusy[slot]);
+
+    // Without a sink the frame has nowhere to go, e.g. when recording stopped while it rendered
+    if (!mSink) {
+        mIsSlotBusy[slot].store(false, std::memory_order_release);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mFrames.push_back({slot, frame});
+    }
+    mWorkCondition.notify_one();
+}
+
+FrameRecorder::Stats FrameRecorder::getStats() {
+    Stats stats;
+    stats.recordedFrameCount = mRecordedFrameCount.load(std::memory_order_relaxed);
+    stats.droppedFrameCount = mDroppedFrameCount.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mLock);
+    stats.pendingFrameCount = static_cast<uint32_t>(mFrames.size());
+    return stats;
+}
+
+void FrameRecorder::recorderLoop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        mWorkCondition.wait(lock, [this] { return mQuit || !mFrames.empty(); });
+        if (mFrames.empty()) {
+            return;
+        }
+
+        const PendingFrame pending = mFrames.front();
+        mFrames.pop_front();
+        mIsSinkBusy = true;
+
+        // The sink only changes on the render thread while no frame is pending or being consumed
+        lock.unlock();
+        mSink->onFrame(pending.frame);
+        mRecordedFrameCount++;
+        mIsSlotBusy[pending.slot].store(false, std::memory_order_release);
+        lock.lock();
+
+        mIsSinkBusy = false;
+        if (mFrames.empty()) {
+            mIdleCondition.notify_all();
+        }
+    }
+}
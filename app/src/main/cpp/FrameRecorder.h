@@ -0,0 +1,112 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+enum class YuvFormat {
+    // Y plane followed by interleaved UV at half resolution
+    kNv12,
+    // Y plane followed by U and V planes at half resolution
+    kI420,
+};
+
+// A frame converted to YUV on the GPU, with the pre-rotation undone
+struct RecordedFrame {
+    const uint8_t* data;
+    size_t size;
+    uint32_t width;
+    uint32_t height;
+    YuvFormat format;
+    uint32_t frameNumber;
+};
+
+// Consumes the frames of a recording session, e.g. a video encoder
+class FrameSink {
+public:
+    virtual ~FrameSink() {}
+    // Called on the recorder thread for every recorded frame in order. The data is only valid
+    // until the call returns.
+    virtual void onFrame(const RecordedFrame& frame) = 0;
+    // Called once the last frame has been consumed
+    virtual void onStop() {}
+};
+
+// Feeds recorded frames to a FrameSink on its own thread. The frames stay in a ring of slots owned
+// by the renderer, and a slot is only reused once the sink is done with it. When the sink falls
+// behind, frames are dropped instead of stalling the render thread.
+class FrameRecorder {
+public:
+    struct Stats {
+        // Frames consumed by the sink
+        uint32_t recordedFrameCount;
+        // Frames rendered while every slot was still busy or without memory for a slot, so they
+        // were never converted
+        uint32_t droppedFrameCount;
+        // Frames waiting for the sink
+        uint32_t pendingFrameCount;
+    };
+
+    static constexpr const uint32_t kSlotCount = 4;
+
+    explicit FrameRecorder();
+    ~FrameRecorder();
+
+    // The APIs below are called from the render thread only
+    void start(std::unique_ptr<FrameSink> sink);
+    // Waits until the sink has consumed the pending frames, then stops it
+    void stop();
+    bool isRecording() const { return mSink != nullptr; }
+    // Returns a free slot for the next frame, or -1 and counts a dropped frame
+    int32_t acquireSlot();
+    // Frees an acquired slot the frame won't be recorded into after all, and counts it as dropped
+    void dropSlot(uint32_t slot);
+    // Hands a slot filled by the GPU to the sink, the slot is free again once the sink returns
+    void submit(uint32_t slot, const RecordedFrame& frame);
+
+    // Thread safe
+    Stats getStats();
+
+private:
+    struct PendingFrame {
+        uint32_t slot;
+        RecordedFrame frame;
+    };
+
+    void recorderLoop();
+
+    std::unique_ptr<FrameSink> mSink;
+    std::atomic<bool> mIsSlotBusy[kSlotCount];
+    std::atomic<uint32_t> mRecordedFrameCount{0};
+    std::atomic<uint32_t> mDroppedFrameCount{0};
+    std::thread mThread;
+
+    // mLock protects the members below
+    std::mutex mLock;
+    std::condition_variable mWorkCondition;
+    std::condition_variable mIdleCondition;
+    std::deque<PendingFrame> mFrames;
+    bool mIsSinkBusy = false;
+    bool mQuit = false;
+};
@@ -0,0 +1,270 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FrameVerifier.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Utils.h"
+
+static bool isQuarterTurn(VkSurfaceTransformFlagBitsKHR preTransform) {
+    return preTransform == VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR ||
+            preTransform == VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR;
+}
+
+// Maps an upright pixel to its index in the pre-rotated image, as ScreenshotWriter does
+static uint32_t getImageIndex(VkSurfaceTransformFlagBitsKHR preTransform, uint32_t imageWidth,
+                              uint32_t imageHeight, uint32_t x, uint32_t y) {
+    switch (preTransform) {
+        case VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR:
+            return x * imageWidth + (imageWidth - 1 - y);
+        case VK_SURFACE_TRANSFORM_ROTATE_180_BIT_KHR:
+            return (imageHeight - 1 - y) * imageWidth + (imageWidth - 1 - x);
+        case VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR:
+            return (imageHeight - 1 - x) * imageWidth + y;
+        default:
+            return y * imageWidth + x;
+    }
+}
+
+// The inverse of getImageIndex
+static void getUprightPoint(VkSurfaceTransformFlagBitsKHR preTransform, uint32_t imageWidth,
+                            uint32_t imageHeight, uint32_t imageX, uint32_t imageY,
+                            uint32_t* outX, uint32_t* outY) {
+    switch (preTransform) {
+        case VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR:
+            *outX = imageY;
+            *outY = imageWidth - 1 - imageX;
+            break;
+        case VK_SURFACE_TRANSFORM_ROTATE_180_BIT_KHR:
+            *outX = imageWidth - 1 - imageX;
+            *outY = imageHeight - 1 - imageY;
+            break;
+        case VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR:
+            *outX = imageHeight - 1 - imageY;
+            *outY = imageX;
+            break;
+        default:
+            *outX = imageX;
+            *outY = imageY;
+            break;
+    }
+}
+
+static uint8_t encodeChannel(float value, bool isSrgb) {
+    if (isSrgb) {
+        value = value <= 0.0031308F ? value * 12.92F
+                                    : 1.055F * std::pow(value, 1.0F / 2.4F) - 0.055F;
+    }
+    return static_cast<uint8_t>(std::lround(std::min(std::max(value, 0.0F), 1.0F) * 255.0F));
+}
+
+// Counts the pixels of a row with any color channel off by more than the tolerance, and updates
+// the first and last of them
+static uint32_t compareRow(const uint8_t* actual, const uint8_t* expected, uint32_t width,
+                           uint32_t tolerance, uint32_t* inOutFirst, uint32_t* inOutLast) {
+    uint32_t mismatchCount = 0;
+    uint32_t x = 0;
+    auto addMismatches = [&](uint32_t mask) {
+        // Bit i is set for a mismatch at x + i
+        mismatchCount += __builtin_popcount(mask);
+        *inOutFirst = std::min(*inOutFirst, x + __builtin_ctz(mask));
+        *inOutLast = std::max(*inOutLast, x + 31 - __builtin_clz(mask));
+    };
+
+#if defined(__SSE2__)
+    // Four pixels at a time, absolute differences with saturating subtractions
+    const __m128i toleranceVector = _mm_set1_epi32(static_cast<int>(tolerance));
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 4 <= width; x += 4) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(actual + x * 4));
+        const __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(expected + x * 4));
+        const __m128i difference = _mm_or_si128(_mm_subs_epu8(a, e), _mm_subs_epu8(e, a));
+        const __m128i excess = _mm_subs_epu8(difference, toleranceVector);
+        const __m128i isMatch = _mm_cmpeq_epi32(excess, zero);
+        const uint32_t mask = ~_mm_movemask_ps(_mm_castsi128_ps(isMatch)) & 0xF;
+        if (mask) {
+            addMismatches(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t toleranceVector = vreinterpretq_u8_u32(vdupq_n_u32(tolerance));
+    for (; x + 4 <= width; x += 4) {
+        const uint8x16_t a = vld1q_u8(actual + x * 4);
+        const uint8x16_t e = vld1q_u8(expected + x * 4);
+        const uint8x16_t excess = vqsubq_u8(vabdq_u8(a, e), toleranceVector);
+        const uint32x4_t isMismatch = vtstq_u32(vreinterpretq_u32_u8(excess),
+                                                vreinterpretq_u32_u8(excess));
+        // One 16-bit lane per pixel, so the common all-match case is a single test
+        const uint64_t lanes = vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(isMismatch)), 0);
+        if (lanes) {
+            uint32_t mask = 0;
+            for (uint32_t i = 0; i < 4; i++) {
+                mask |= ((lanes >> (i * 16)) & 1) << i;
+            }
+            addMismatches(mask);
+        }
+    }
+#endif
+
+    for (; x < width; x++) {
+        const uint8_t* a = actual + x * 4;
+        const uint8_t* e = expected + x * 4;
+        for (uint32_t c = 0; c < 4; c++) {
+            const uint32_t difference = a[c] > e[c] ? a[c] - e[c] : e[c] - a[c];
+            if (difference > ((tolerance >> (c * 8)) & 0xFF)) {
+                addMismatches(1);
+                break;
+            }
+        }
+    }
+    return mismatchCount;
+}
+
+void FrameVerifier::setTexture(TextureLoader::Image image) {
+    ASSERT(image.width && image.height && image.pixels);
+    mTextureWidth = image.width;
+    mTextureHeight = image.height;
+    mImage = std::move(image);
+    mTexture.clear();
+    mIsExpectedFrameDirty = true;
+}
+
+void FrameVerifier::setTarget(uint32_t surfaceWidth, uint32_t surfaceHeight,
+                              VkSurfaceTransformFlagBitsKHR preTransform, bool isBgra,
+                              bool isSrgb) {
+    if (surfaceWidth != mSurfaceWidth || surfaceHeight != mSurfaceHeight ||
+        preTransform != mPreTransform || isBgra != mIsBgra || isSrgb != mIsSrgb) {
+        mSurfaceWidth = surfaceWidth;
+        mSurfaceHeight = surfaceHeight;
+        mPreTransform = preTransform;
+        mIsBgra = isBgra;
+        mIsSrgb = isSrgb;
+        mIsExpectedFrameDirty = true;
+    }
+    if (mIsExpectedFrameDirty) {
+        buildExpectedFrame();
+    }
+}
+
+void FrameVerifier::setTolerance(uint8_t tolerance) {
+    mTolerance = tolerance * 0x010101U | 0xFF000000U;
+}
+
+FrameVerifier::Result FrameVerifier::verify(const uint8_t* pixels) const {
+    ASSERT(!mIsExpectedFrameDirty);
+
+    // Compared in image order, which reads both frames linearly. Only the bounding box is mapped
+    // back to the upright orientation.
+    Result result = {};
+    uint32_t minX = UINT32_MAX;
+    uint32_t maxX = 0;
+    uint32_t minY = UINT32_MAX;
+    uint32_t maxY = 0;
+    const size_t rowSize = size_t(mImageWidth) * 4;
+    for (uint32_t y = 0; y < mImageHeight; y++) {
+        const uint32_t rowMismatchCount =
+                compareRow(pixels + y * rowSize, mExpectedFrame.data() + y * rowSize, mImageWidth,
+                           mTolerance, &minX, &maxX);
+        if (rowMismatchCount) {
+            result.mismatchCount += rowMismatchCount;
+            minY = std::min(minY, y);
+            maxY = y;
+        }
+    }
+    if (!result.mismatchCount) {
+        return result;
+    }
+
+    // Opposite corners of the box in the image are opposite corners of the upright box too
+    uint32_t x0, y0, x1, y1;
+    getUprightPoint(mPreTransform, mImageWidth, mImageHeight, minX, minY, &x0, &y0);
+    getUprightPoint(mPreTransform, mImageWidth, mImageHeight, maxX, maxY, &x1, &y1);
+    result.left = std::min(x0, x1);
+    result.top = std::min(y0, y1);
+    result.right = std::max(x0, x1) + 1;
+    result.bottom = std::max(y0, y1) + 1;
+    return result;
+}
+
+void FrameVerifier::buildExpectedFrame() {
+    ASSERT((mImage.pixels || !mTexture.empty()) && mSurfaceWidth && mSurfaceHeight);
+    mIsExpectedFrameDirty = false;
+
+    if (mImage.pixels) {
+        mTexture.resize(size_t(mTextureWidth) * mTextureHeight * 4);
+        TextureLoader::copyToRgba(mImage, mTexture.data(), size_t(mTextureWidth) * 4);
+        mImage = TextureLoader::Image();
+    }
+
+    const bool isSwapped = isQuarterTurn(mPreTransform);
+    mImageWidth = isSwapped ? mSurfaceHeight : mSurfaceWidth;
+    mImageHeight = isSwapped ? mSurfaceWidth : mSurfaceHeight;
+    mExpectedFrame.resize(size_t(mImageWidth) * mImageHeight * 4);
+
+    // The same fit as the mvp in Renderer::recordDraws, in normalized device coordinates
+    const float scaleW = mSurfaceWidth / static_cast<float>(mTextureWidth);
+    const float scaleH = mSurfaceHeight / static_cast<float>(mTextureHeight);
+    const float minimalScale = std::min(scaleW, scaleH);
+    const float scaleX = minimalScale / scaleW;
+    const float scaleY = minimalScale / scaleH;
+
+    // Texels are sampled as is and written through the swapchain format
+    uint8_t encoded[256];
+    for (uint32_t i = 0; i < 256; i++) {
+        encoded[i] = encodeChannel(i / 255.0F, mIsSrgb);
+    }
+    const uint8_t clear = encodeChannel(kClearValue, mIsSrgb);
+    const uint32_t redOffset = mIsBgra ? 2 : 0;
+    const uint32_t blueOffset = mIsBgra ? 0 : 2;
+
+    for (uint32_t y = 0; y < mSurfaceHeight; y++) {
+        const float ndcY = (y + 0.5F) / mSurfaceHeight * 2.0F - 1.0F;
+        for (uint32_t x = 0; x < mSurfaceWidth; x++) {
+            const float ndcX = (x + 0.5F) / mSurfaceWidth * 2.0F - 1.0F;
+            uint8_t* dst = mExpectedFrame.data() +
+                    size_t(getImageIndex(mPreTransform, mImageWidth, mImageHeight, x, y)) * 4;
+            if (std::abs(ndcX) >= scaleX || std::abs(ndcY) >= scaleY) {
+                dst[0] = clear;
+                dst[1] = clear;
+                dst[2] = clear;
+                dst[3] = 0xFF;
+                continue;
+            }
+
+            // Nearest filtering of the quad, whose texture coordinates span [0, 1]
+            const float u = (ndcX / scaleX + 1.0F) * 0.5F;
+            const float v = (ndcY / scaleY + 1.0F) * 0.5F;
+            const uint32_t texelX =
+                    std::min(static_cast<uint32_t>(u * mTextureWidth), mTextureWidth - 1);
+            const uint32_t texelY =
+                    std::min(static_cast<uint32_t>(v * mTextureHeight), mTextureHeight - 1);
+            const uint8_t* texel = mTexture.data() + (size_t(texelY) * mTextureWidth + texelX) * 4;
+            dst[redOffset] = encoded[texel[0]];
+            dst[1] = encoded[texel[1]];
+            dst[blueOffset] = encoded[texel[2]];
+            dst[3] = texel[3];
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "TextureLoader.h"
+
+// Checks rendered frames against what the renderer should have drawn: the texture scaled to fit
+// the surface over the clear color, pre-rotated the same way. The expected frame is built on the
+// CPU once per surface size and pre-rotation, and compared against read back frames with SSE2 or
+// NEON where available. Each channel may be off by a tolerance, e.g. for rounding or sRGB encoding.
+class FrameVerifier {
+public:
+    struct Result {
+        uint32_t mismatchCount;
+        // Bounding box of the mismatched pixels as the display shows them, with right and bottom
+        // exclusive. Empty when every pixel matched.
+        uint32_t left;
+        uint32_t top;
+        uint32_t right;
+        uint32_t bottom;
+    };
+
+    explicit FrameVerifier() { setTolerance(kDefaultTolerance); }
+    // Takes the decoded texture as it was uploaded. It's only converted to RGBA once a frame is
+    // verified against it, so it costs nothing while verification is off.
+    void setTexture(TextureLoader::Image image);
+    // Describes the frames verified next. The expected frame is only rebuilt if something changed.
+    // The surface size is upright, like mSurfaceWidth and mSurfaceHeight of the renderer.
+    void setTarget(uint32_t surfaceWidth, uint32_t surfaceHeight,
+                   VkSurfaceTransformFlagBitsKHR preTransform, bool isBgra, bool isSrgb);
+    // Per color channel, alpha is never compared
+    void setTolerance(uint8_t tolerance);
+    // pixels holds a frame as it was copied out of the swapchain image, tightly packed with 4 bytes
+    // per pixel
+    Result verify(const uint8_t* pixels) const;
+
+private:
+    void buildExpectedFrame();
+
+    // Until converted into mTexture
+    TextureLoader::Image mImage;
+    // Tightly packed RGBA
+    std::vector<uint8_t> mTexture;
+    uint32_t mTextureWidth = 0;
+    uint32_t mTextureHeight = 0;
+
+    uint32_t mSurfaceWidth = 0;
+    uint32_t mSurfaceHeight = 0;
+    VkSurfaceTransformFlagBitsKHR mPreTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+    bool mIsBgra = false;
+    bool mIsSrgb = false;
+    // Bytes of a pixel packed into a word, with alpha always within tolerance
+    uint32_t mTolerance = 0;
+
+    // Pre-rotated like the swapchain image
+    std::vector<uint8_t> mExpectedFrame;
+    uint32_t mImageWidth = 0;
+    uint32_t mImageHeight = 0;
+    bool mIsExpectedFrameDirty = true;
+
+    static constexpr const uint8_t kDefaultTolerance = 2;
+    // Must match the clear color of the renderer
+    static constexpr const float kClearValue = 0.5F;
+};
@@ -0,0 +1,498 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MemoryAllocator.h"
+
+#include <algorithm>
+
+#include "Utils.h"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    destroy();
+}
+
+void MemoryAllocator::initialize(const VkHelper* vk, VkPhysicalDevice gpu, VkDevice device,
+                                 bool hasMemoryBudget, ResourceTracker* tracker) {
+    mVk = vk;
+    mGpu = gpu;
+    mDevice = device;
+    mHasMemoryBudget = hasMemoryBudget;
+    mTracker = tracker;
+    mVk->GetPhysicalDeviceMemoryProperties(gpu, &mMemoryProperties);
+
+    VkPhysicalDeviceProperties gpuProperties;
+    mVk->GetPhysicalDeviceProperties(gpu, &gpuProperties);
+    mNonCoherentAtomSize = std::max<VkDeviceSize>(gpuProperties.limits.nonCoherentAtomSize, 1);
+
+    for (uint32_t typeIndex = 0; typeIndex < mMemoryProperties.memoryTypeCount; typeIndex++) {
+        const VkMemoryType& type = mMemoryProperties.memoryTypes[typeIndex];
+        ALOGD("MemoryAllocator: memory type %u: flags 0x%x, heap %u of %llu MiB", typeIndex,
+              type.propertyFlags, type.heapIndex,
+              (unsigned long long)(mMemoryProperties.memoryHeaps[type.heapIndex].size >> 20));
+    }
+    updateBudget();
+}
+
+void MemoryAllocator::destroy() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mStats.allocationCount) {
+        ALOGD("MemoryAllocator: %u allocations leaked", mStats.allocationCount);
+    }
+    for (auto& block : mBlocks) {
+        freeDeviceMemory(block->memory, block->size, block->memoryTypeIndex, block->data);
+    }
+    mBlocks.clear();
+    mStats = {};
+    std::fill(mHeapAllocatedBytes, mHeapAllocatedBytes + VK_MAX_MEMORY_HEAPS, 0);
+    mDevice = VK_NULL_HANDLE;
+}
+
+void MemoryAllocator::getRequirements(VkBuffer buffer, Requirements* outRequirements) {
+    *outRequirements = {};
+    outRequirements->isLinear = true;
+    outRequirements->buffer = buffer;
+
+    // Core in Vulkan 1.1, without it the driver can't ask for a dedicated allocation
+    if (!mVk->GetBufferMemoryRequirements2) {
+        mVk->GetBufferMemoryRequirements(mDevice, buffer, &outRequirements->memoryRequirements);
+        return;
+    }
+    VkMemoryDedicatedRequirements dedicatedRequirements = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+            .pNext = nullptr,
+    };
+    const VkBufferMemoryRequirementsInfo2 requirementsInfo = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2,
+            .pNext = nullptr,
+            .buffer = buffer,
+    };
+    VkMemoryRequirements2 memoryRequirements = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+            .pNext = &dedicatedRequirements,
+    };
+    mVk->GetBufferMemoryRequirements2(mDevice, &requirementsInfo, &memoryRequirements);
+    outRequirements->memoryRequirements = memoryRequirements.memoryRequirements;
+    outRequirements->isDedicated = dedicatedRequirements.requiresDedicatedAllocation ||
+            dedicatedRequirements.prefersDedicatedAllocation;
+}
+
+void MemoryAllocator::getRequirements(VkImage image, VkImageTiling tiling,
+                                      Requirements* outRequirements) {
+    *outRequirements = {};
+    outRequirements->isLinear = tiling == VK_IMAGE_TILING_LINEAR;
+    outRequirements->image = image;
+
+    if (!mVk->GetImageMemoryRequirements2) {
+        mVk->GetImageMemoryRequirements(mDevice, image, &outRequirements->memoryRequirements);
+        return;
+    }
+    VkMemoryDedicatedRequirements dedicatedRequirements = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+            .pNext = nullptr,
+    };
+    const VkImageMemoryRequirementsInfo2 requirementsInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+            .pNext = nullptr,
+            .image = image,
+    };
+    VkMemoryRequirements2 memoryRequirements = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+            .pNext = &dedicatedRequirements,
+    };
+    mVk->GetImageMemoryRequirements2(mDevice, &requirementsInfo, &memoryRequirements);
+    outRequirements->memoryRequirements = memoryRequirements.memoryRequirements;
+    outRequirements->isDedicated = dedicatedRequirements.requiresDedicatedAllocation ||
+            dedicatedRequirements.prefersDedicatedAllocation;
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeBits, MemoryUsage usage,
+                                         VkMemoryPropertyFlags requiredFlags,
+                                         VkMemoryPropertyFlags preferredFlags,
+                                         VkMemoryPropertyFlags avoidedFlags) const {
+    switch (usage) {
+        case MemoryUsage::kGpuOnly:
+            // Host-visible device memory is scarce on discrete GPUs, leave it to uploads
+            preferredFlags |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            avoidedFlags |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+            break;
+        case MemoryUsage::kUpload:
+            requiredFlags |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+            avoidedFlags |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+            break;
+        case MemoryUsage::kReadback:
+            requiredFlags |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+            preferredFlags |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+            break;
+    }
+
+    // Every preferred flag gains as much as every avoided one costs. For the host, coherent breaks
+    // ties, as it saves the flushes and invalidates. Among equal types the first one wins, as the
+    // spec orders types with the same flags by performance.
+    uint32_t bestIndex = kNoMemoryType;
+    int32_t bestScore = 0;
+    for (uint32_t typeIndex = 0; typeIndex < mMemoryProperties.memoryTypeCount; typeIndex++) {
+        const VkMemoryPropertyFlags flags = mMemoryProperties.memoryTypes[typeIndex].propertyFlags;
+        if (!(typeBits & (1U << typeIndex)) || (flags & requiredFlags) != requiredFlags) {
+            continue;
+        }
+        const int32_t score = 2 * __builtin_popcount(flags & preferredFlags) -
+                2 * __builtin_popcount(flags & avoidedFlags) +
+                ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+                                 (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+                         ? 1
+                         : 0);
+        if (bestIndex == kNoMemoryType || score > bestScore) {
+            bestIndex = typeIndex;
+            bestScore = score;
+        }
+    }
+    return bestIndex;
+}
+
+void MemoryAllocator::allocate(const Requirements& requirements, MemoryUsage usage,
+                               Allocation* outAllocation) {
+    uint32_t typeBits = requirements.memoryRequirements.memoryTypeBits;
+    for (;;) {
+        const uint32_t memoryTypeIndex = findMemoryType(typeBits, usage);
+        ASSERT(memoryTypeIndex != kNoMemoryType);
+        if (allocateOfType(requirements, memoryTypeIndex, outAllocation)) {
+            return;
+        }
+        ALOGD("MemoryAllocator: memory type %u is out of memory, trying the next best",
+              memoryTypeIndex);
+        typeBits &= ~(1U << memoryTypeIndex);
+    }
+}
+
+bool MemoryAllocator::allocateOfType(const Requirements& requirements, uint32_t memoryTypeIndex,
+                                     Allocation* outAllocation, VkDeviceSize maxNewBytes) {
+    *outAllocation = Allocation();
+    outAllocation->memoryTypeIndex = memoryTypeIndex;
+
+    // Ranges of non-coherent memory are flushed and invalidated whole atoms at a time, so they
+    // must not share an atom with their neighbors
+    VkDeviceSize size = requirements.memoryRequirements.size;
+    VkDeviceSize alignment = requirements.memoryRequirements.alignment;
+    if (isNonCoherent(memoryTypeIndex)) {
+        size = alignUp(size, mNonCoherentAtomSize);
+        alignment = std::max(alignment, mNonCoherentAtomSize);
+    }
+
+    // Small heaps, e.g. the host-visible part of VRAM, get smaller blocks
+    const uint32_t heapIndex = mMemoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    const VkDeviceSize blockSize =
+            std::min(kBlockSize, alignUp(mMemoryProperties.memoryHeaps[heapIndex].size / 8,
+                                         mNonCoherentAtomSize));
+
+    std::lock_guard<std::mutex> lock(mLock);
+    if (requirements.isDedicated || size > std::min(kMaxSubAllocationSize, blockSize / 2)) {
+        // A dedicated allocation must be exactly the size of its resource
+        const VkDeviceSize dedicatedSize = requirements.memoryRequirements.size;
+        if (dedicatedSize > maxNewBytes) {
+            return false;
+        }
+        outAllocation->memory = allocateDeviceMemory(dedicatedSize, memoryTypeIndex,
+                                                     requirements.isDedicated ? &requirements
+                                                                              : nullptr,
+                                                     &outAllocation->data);
+        if (outAllocation->memory == VK_NULL_HANDLE) {
+            return false;
+        }
+        outAllocation->size = dedicatedSize;
+        mStats.dedicatedAllocationCount++;
+        mStats.allocationCount++;
+        mStats.usedBytes += dedicatedSize;
+        return true;
+    }
+
+    for (auto& block : mBlocks) {
+        if (block->memoryTypeIndex == memoryTypeIndex &&
+            block->isLinear == requirements.isLinear &&
+            allocateFromBlock(block.get(), size, alignment, outAllocation)) {
+            return true;
+        }
+    }
+
+    if (blockSize > maxNewBytes) {
+        return false;
+    }
+    auto block = std::make_unique<Block>();
+    void* data = nullptr;
+    block->memory = allocateDeviceMemory(blockSize, memoryTypeIndex, nullptr, &data);
+    if (block->memory == VK_NULL_HANDLE) {
+        return false;
+    }
+    block->size = blockSize;
+    block->data = static_cast<uint8_t*>(data);
+    block->memoryTypeIndex = memoryTypeIndex;
+    block->isLinear = requirements.isLinear;
+    block->freeRanges.push_back({0, blockSize});
+    block->allocationCount = 0;
+    mStats.blockCount++;
+    ALOGD("MemoryAllocator: created %s block of %llu bytes in memory type %u",
+          requirements.isLinear ? "linear" : "optimal", (unsigned long long)blockSize,
+          memoryTypeIndex);
+
+    ASSERT(allocateFromBlock(block.get(), size, alignment, outAllocation));
+    mBlocks.push_back(std::move(block));
+    return true;
+}
+
+bool MemoryAllocator::allocateOptional(const Requirements& requirements, MemoryUsage usage,
+                                       Allocation* outAllocation) {
+    const uint32_t memoryTypeIndex =
+            findMemoryType(requirements.memoryRequirements.memoryTypeBits, usage);
+    ASSERT(memoryTypeIndex != kNoMemoryType);
+
+    // Only the best type is tried, a worse one isn't worth it for an optional resource. The heap
+    // grows by the device memory actually allocated, a whole block if none has room, so that is
+    // what has to fit under the limit. Space left in the existing blocks is always fine to use.
+    VkDeviceSize budgets[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize usages[VK_MAX_MEMORY_HEAPS];
+    getHeapBudgets(budgets, usages);
+    const uint32_t heapIndex = mMemoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    const VkDeviceSize limit = budgets[heapIndex] / 100 * kOptionalBudgetPercent;
+    const VkDeviceSize maxNewBytes = usages[heapIndex] < limit ? limit - usages[heapIndex] : 0;
+    if (!allocateOfType(requirements, memoryTypeIndex, outAllocation, maxNewBytes)) {
+        ALOGD("MemoryAllocator: refused %llu bytes, heap %u is at %llu of %llu bytes",
+              (unsigned long long)requirements.memoryRequirements.size, heapIndex,
+              (unsigned long long)usages[heapIndex], (unsigned long long)budgets[heapIndex]);
+        return false;
+    }
+    return true;
+}
+
+void MemoryAllocator::free(Allocation* allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mStats.allocationCount--;
+    mStats.usedBytes -= allocation->size;
+    Block* block = allocation->block;
+    if (!block) {
+        freeDeviceMemory(allocation->memory, allocation->size, allocation->memoryTypeIndex,
+                         allocation->data);
+        mStats.dedicatedAllocationCount--;
+        *allocation = Allocation();
+        return;
+    }
+
+    freeToBlock(block, allocation->offset, allocation->size);
+    *allocation = Allocation();
+    if (--block->allocationCount) {
+        return;
+    }
+
+    // Keep a single empty block of each kind, so a resource recreated on every swapchain
+    // recreation doesn't free and allocate a block each time
+    const bool hasOtherEmptyBlock = std::any_of(
+            mBlocks.begin(), mBlocks.end(), [block](const std::unique_ptr<Block>& other) {
+                return other.get() != block && other->allocationCount == 0 &&
+                        other->memoryTypeIndex == block->memoryTypeIndex &&
+                        other->isLinear == block->isLinear;
+            });
+    if (!hasOtherEmptyBlock) {
+        return;
+    }
+    freeDeviceMemory(block->memory, block->size, block->memoryTypeIndex, block->data);
+    mBlocks.erase(std::find_if(mBlocks.begin(), mBlocks.end(),
+                               [block](const std::unique_ptr<Block>& other) {
+                                   return other.get() == block;
+                               }));
+    mStats.blockCount--;
+}
+
+void MemoryAllocator::flush(const Allocation& allocation) {
+    if (!isNonCoherent(allocation.memoryTypeIndex)) {
+        return;
+    }
+    const VkMappedMemoryRange range = getMappedRange(allocation);
+    ASSERT(mVk->FlushMappedMemoryRanges(mDevice, 1, &range) == VK_SUCCESS);
+}
+
+void MemoryAllocator::invalidate(const Allocation& allocation) {
+    if (!isNonCoherent(allocation.memoryTypeIndex)) {
+        return;
+    }
+    const VkMappedMemoryRange range = getMappedRange(allocation);
+    ASSERT(mVk->InvalidateMappedMemoryRanges(mDevice, 1, &range) == VK_SUCCESS);
+}
+
+void MemoryAllocator::updateBudget() {
+    VkDeviceSize budgets[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize usages[VK_MAX_MEMORY_HEAPS];
+    getHeapBudgets(budgets, usages);
+    for (uint32_t heapIndex = 0; heapIndex < mMemoryProperties.memoryHeapCount; heapIndex++) {
+        mTracker->setHeapBudget(heapIndex, mMemoryProperties.memoryHeaps[heapIndex].size,
+                                budgets[heapIndex], usages[heapIndex]);
+    }
+}
+
+MemoryAllocator::Stats MemoryAllocator::getStats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mStats;
+}
+
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex,
+                                                     const Requirements* dedicatedRequirements,
+                                                     void** outData) {
+    const VkMemoryDedicatedAllocateInfo dedicatedAllocateInfo = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+            .pNext = nullptr,
+            .image = dedicatedRequirements ? dedicatedRequirements->image : VK_NULL_HANDLE,
+            .buffer = dedicatedRequirements ? dedicatedRequirements->buffer : VK_NULL_HANDLE,
+    };
+    const VkMemoryAllocateInfo memoryAllocateInfo = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .pNext = dedicatedRequirements ? &dedicatedAllocateInfo : nullptr,
+            .allocationSize = size,
+            .memoryTypeIndex = memoryTypeIndex,
+    };
+    *outData = nullptr;
+    VkDeviceMemory memory;
+    const VkResult result = mVk->AllocateMemory(mDevice, &memoryAllocateInfo, nullptr, &memory);
+    if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY) {
+        return VK_NULL_HANDLE;
+    }
+    ASSERT(result == VK_SUCCESS);
+
+    if (mMemoryProperties.memoryTypes[memoryTypeIndex].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        ASSERT(mVk->MapMemory(mDevice, memory, 0, VK_WHOLE_SIZE, 0, outData) == VK_SUCCESS);
+    }
+    mStats.allocatedBytes += size;
+    mHeapAllocatedBytes[mMemoryProperties.memoryTypes[memoryTypeIndex].heapIndex] += size;
+    mTracker->onAllocate(mMemoryProperties.memoryTypes[memoryTypeIndex].heapIndex, size);
+    return memory;
+}
+
+void MemoryAllocator::freeDeviceMemory(VkDeviceMemory memory, VkDeviceSize size,
+                                       uint32_t memoryTypeIndex, void* data) {
+    if (data) {
+        mVk->UnmapMemory(mDevice, memory);
+    }
+    mVk->FreeMemory(mDevice, memory, nullptr);
+    mStats.allocatedBytes -= size;
+    mHeapAllocatedBytes[mMemoryProperties.memoryTypes[memoryTypeIndex].heapIndex] -= size;
+    mTracker->onFree(mMemoryProperties.memoryTypes[memoryTypeIndex].heapIndex, size);
+}
+
+void MemoryAllocator::getHeapBudgets(VkDeviceSize* outBudgets, VkDeviceSize* outUsages) {
+    if (mHasMemoryBudget) {
+        // Also accounts for the memory of other processes and of the driver itself
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+                .pNext = nullptr,
+        };
+        VkPhysicalDeviceMemoryProperties2 memoryProperties2 = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+                .pNext = &budgetProperties,
+        };
+        mVk->GetPhysicalDeviceMemoryProperties2(mGpu, &memoryProperties2);
+        std::copy(budgetProperties.heapBudget, budgetProperties.heapBudget + VK_MAX_MEMORY_HEAPS,
+                  outBudgets);
+        std::copy(budgetProperties.heapUsage, budgetProperties.heapUsage + VK_MAX_MEMORY_HEAPS,
+                  outUsages);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    for (uint32_t heapIndex = 0; heapIndex < VK_MAX_MEMORY_HEAPS; heapIndex++) {
+        outBudgets[heapIndex] =
+                mMemoryProperties.memoryHeaps[heapIndex].size / 100 * kFallbackBudgetPercent;
+        outUsages[heapIndex] = mHeapAllocatedBytes[heapIndex];
+    }
+}
+
+bool MemoryAllocator::allocateFromBlock(Block* block, VkDeviceSize size, VkDeviceSize alignment,
+                                        Allocation* outAllocation) {
+    for (size_t i = 0; i < block->freeRanges.size(); i++) {
+        const Range range = block->freeRanges[i];
+        const VkDeviceSize offset = alignUp(range.offset, alignment);
+        if (offset + size > range.offset + range.size) {
+            continue;
+        }
+
+        // What's left in front of and behind the allocation stays free
+        const Range front = {range.offset, offset - range.offset};
+        const Range back = {offset + size, range.offset + range.size - offset - size};
+        block->freeRanges.erase(block->freeRanges.begin() + i);
+        if (back.size) {
+            block->freeRanges.insert(block->freeRanges.begin() + i, back);
+        }
+        if (front.size) {
+            block->freeRanges.insert(block->freeRanges.begin() + i, front);
+        }
+
+        outAllocation->memory = block->memory;
+        outAllocation->offset = offset;
+        outAllocation->size = size;
+        outAllocation->data = block->data ? block->data + offset : nullptr;
+        outAllocation->block = block;
+        block->allocationCount++;
+        mStats.allocationCount++;
+        mStats.usedBytes += size;
+        return true;
+    }
+    return false;
+}
+
+void MemoryAllocator::freeToBlock(Block* block, VkDeviceSize offset, VkDeviceSize size) {
+    auto& ranges = block->freeRanges;
+    auto next = std::lower_bound(ranges.begin(), ranges.end(), offset,
+                                 [](const Range& range, VkDeviceSize value) {
+                                     return range.offset < value;
+                                 });
+    auto it = ranges.insert(next, {offset, size});
+
+    // Merge with the following range, then the preceding one
+    auto following = it + 1;
+    if (following != ranges.end() && it->offset + it->size == following->offset) {
+        it->size += following->size;
+        it = ranges.erase(following) - 1;
+    }
+    if (it != ranges.begin()) {
+        auto preceding = it - 1;
+        if (preceding->offset + preceding->size == it->offset) {
+            preceding->size += it->size;
+            ranges.erase(it);
+        }
+    }
+}
+
+bool MemoryAllocator::isNonCoherent(uint32_t memoryTypeIndex) const {
+    const VkMemoryPropertyFlags flags =
+            mMemoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    return (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+            !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+VkMappedMemoryRange MemoryAllocator::getMappedRange(const Allocation& allocation) const {
+    // Sub-allocations are whole atoms, see allocate. A dedicated allocation is mapped whole.
+    return {
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .pNext = nullptr,
+            .memory = allocation.memory,
+            .offset = allocation.offset,
+            .size = allocation.block ? allocation.size : VK_WHOLE_SIZE,
+    };
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ResourceTracker.h"
+#include "VkHelper.h"
+
+// How a resource is accessed, which decides the memory type it is placed in
+enum class MemoryUsage {
+    // Only ever accessed by the GPU
+    kGpuOnly,
+    // Written sequentially by the host and read by the GPU, best in uncached write-combined memory
+    kUpload,
+    // Written by the GPU and read by the host, far faster from HOST_CACHED memory
+    kReadback,
+};
+
+// Sub-allocates buffers and images out of large VkDeviceMemory blocks, one set of blocks per
+// memory type, so creating a resource rarely costs a vkAllocateMemory. Each block keeps a list of
+// free ranges and hands out the first one that fits. Linear resources and optimal images never
+// share a block, so bufferImageGranularity never has to be respected between neighbors.
+// Host-visible blocks stay mapped for their whole lifetime. The memory type of each allocation is
+// picked from the properties queried once at initialization. Thread safe.
+class MemoryAllocator {
+private:
+    struct Block;
+
+public:
+    struct Requirements {
+        VkMemoryRequirements memoryRequirements;
+        // Buffers and linear images, as opposed to optimal images
+        bool isLinear;
+        // Set when the driver wants the resource in an allocation of its own
+        bool isDedicated;
+        // The resource to dedicate the allocation to
+        VkBuffer buffer;
+        VkImage image;
+    };
+
+    struct Allocation {
+        VkDeviceMemory memory;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        // Mapped address of offset, or null if the memory isn't host visible
+        void* data;
+        uint32_t memoryTypeIndex;
+        // Null for a dedicated allocation
+        Block* block;
+
+        Allocation()
+              : memory(VK_NULL_HANDLE),
+                offset(0),
+                size(0),
+                data(nullptr),
+                memoryTypeIndex(0),
+                block(nullptr) {}
+    };
+
+    struct Stats {
+        uint32_t blockCount;
+        uint32_t dedicatedAllocationCount;
+        // Both sub-allocated and dedicated
+        uint32_t allocationCount;
+        // Everything allocated from the device, including the free space of the blocks
+        VkDeviceSize allocatedBytes;
+        // Handed out to resources
+        VkDeviceSize usedBytes;
+    };
+
+    static constexpr const uint32_t kNoMemoryType = UINT32_MAX;
+
+    explicit MemoryAllocator() {}
+    ~MemoryAllocator();
+    // VK_EXT_memory_budget must be enabled on the device for hasMemoryBudget. Device memory is
+    // reported to the tracker, which must outlive the allocator.
+    void initialize(const VkHelper* vk, VkPhysicalDevice gpu, VkDevice device,
+                    bool hasMemoryBudget, ResourceTracker* tracker);
+    // Everything must have been freed by now
+    void destroy();
+
+    void getRequirements(VkBuffer buffer, Requirements* outRequirements);
+    void getRequirements(VkImage image, VkImageTiling tiling, Requirements* outRequirements);
+    // Ranks the memory types allowed by typeBits for the usage, adjusted by the extra flags. Only
+    // types with all of requiredFlags qualify. Returns kNoMemoryType if none does.
+    uint32_t findMemoryType(uint32_t typeBits, MemoryUsage usage,
+                            VkMemoryPropertyFlags requiredFlags = 0,
+                            VkMemoryPropertyFlags preferredFlags = 0,
+                            VkMemoryPropertyFlags avoidedFlags = 0) const;
+    // In the best memory type for the usage, or the next best ones if that heap is out of memory.
+    // The caller binds the resource to memory at offset.
+    void allocate(const Requirements& requirements, MemoryUsage usage, Allocation* outAllocation);
+    // For resources the renderer can do without. Returns false instead of allocating if the heap of
+    // the best memory type is close to its budget, or out of memory.
+    bool allocateOptional(const Requirements& requirements, MemoryUsage usage,
+                          Allocation* outAllocation);
+    void free(Allocation* allocation);
+    // No-ops for coherent memory
+    void flush(const Allocation& allocation);
+    void invalidate(const Allocation& allocation);
+    Stats getStats();
+    // Queries the budget of every heap and reports it to the tracker
+    void updateBudget();
+
+private:
+    struct Range {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+    };
+
+    struct Block {
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        uint8_t* data;
+        uint32_t memoryTypeIndex;
+        bool isLinear;
+        // Sorted by offset, and neighbors are always merged
+        std::vector<Range> freeRanges;
+        uint32_t allocationCount;
+    };
+
+    // Fails instead of allocating more than maxNewBytes of device memory, which is what a new
+    // block or a dedicated allocation would cost
+    bool allocateOfType(const Requirements& requirements, uint32_t memoryTypeIndex,
+                        Allocation* outAllocation, VkDeviceSize maxNewBytes = VK_WHOLE_SIZE);
+    // Returns VK_NULL_HANDLE if the heap is out of memory
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex,
+                                        const Requirements* dedicatedRequirements, void** outData);
+    void freeDeviceMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryTypeIndex,
+                          void* data);
+    void getHeapBudgets(VkDeviceSize* outBudgets, VkDeviceSize* outUsages);
+    bool allocateFromBlock(Block* block, VkDeviceSize size, VkDeviceSize alignment,
+                           Allocation* outAllocation);
+    void freeToBlock(Block* block, VkDeviceSize offset, VkDeviceSize size);
+    // Host visible, but without HOST_COHERENT
+    bool isNonCoherent(uint32_t memoryTypeIndex) const;
+    VkMappedMemoryRange getMappedRange(const Allocation& allocation) const;
+
+    const VkHelper* mVk = nullptr;
+    VkPhysicalDevice mGpu = VK_NULL_HANDLE;
+    VkDevice mDevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties mMemoryProperties = {};
+    VkDeviceSize mNonCoherentAtomSize = 1;
+    bool mHasMemoryBudget = false;
+    ResourceTracker* mTracker = nullptr;
+
+    // mLock protects everything below
+    std::mutex mLock;
+    std::vector<std::unique_ptr<Block>> mBlocks;
+    Stats mStats = {};
+    // Device memory allocated from each heap
+    VkDeviceSize mHeapAllocatedBytes[VK_MAX_MEMORY_HEAPS] = {};
+
+    static constexpr const VkDeviceSize kBlockSize = 32 * 1024 * 1024;
+    // Anything larger gets a dedicated allocation, so a block isn't wasted on a single resource
+    static constexpr const VkDeviceSize kMaxSubAllocationSize = kBlockSize / 2;
+    // Share of a heap assumed to be available without VK_EXT_memory_budget
+    static constexpr const uint32_t kFallbackBudgetPercent = 80;
+    // Optional allocations are refused once the heap usage would go over this share of its budget
+    static constexpr const uint32_t kOptionalBudgetPercent = 90;
+};
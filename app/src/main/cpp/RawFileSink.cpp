@@ -0,0 +1,60 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RawFileSink.h"
+
+#include "Utils.h"
+
+RawFileSink::RawFileSink(const std::string& path) : mPath(path) {
+    mFile = fopen(path.c_str(), "wb");
+    if (!mFile) {
+        ALOGD("%s: failed to open %s", __FUNCTION__, path.c_str());
+    }
+}
+
+RawFileSink::~RawFileSink() {
+    onStop();
+}
+
+void RawFileSink::onFrame(const RecordedFrame& frame) {
+    if (!mFile) {
+        return;
+    }
+
+    if (frame.width != mWidth || frame.height != mHeight) {
+        ALOGD("%s: %s is %ux%u %s from frame %u on", __FUNCTION__, mPath.c_str(), frame.width,
+              frame.height, frame.format == YuvFormat::kNv12 ? "NV12" : "I420", mFrameCount);
+        mWidth = frame.width;
+        mHeight = frame.height;
+    }
+
+    if (fwrite(frame.data, 1, frame.size, mFile) != frame.size) {
+        ALOGD("%s: failed to write %s", __FUNCTION__, mPath.c_str());
+        fclose(mFile);
+        mFile = nullptr;
+        return;
+    }
+    mFrameCount++;
+}
+
+void RawFileSink::onStop() {
+    if (!mFile) {
+        return;
+    }
+    fclose(mFile);
+    mFile = nullptr;
+    ALOGD("%s: wrote %u frames to %s", __FUNCTION__, mFrameCount, mPath.c_str());
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+#include "FrameRecorder.h"
+
+// Appends every recorded frame to a file as is, a local stand-in for a video encoder. The file
+// plays back with e.g. ffplay -f rawvideo -pixel_format nv12 -video_size WxH, as long as the size
+// didn't change during the session.
+class RawFileSink : public FrameSink {
+public:
+    explicit RawFileSink(const std::string& path);
+    ~RawFileSink() override;
+    void onFrame(const RecordedFrame& frame) override;
+    void onStop() override;
+
+private:
+    std::string mPath;
+    FILE* mFile = nullptr;
+    uint32_t mWidth = 0;
+    uint32_t mHeight = 0;
+    uint32_t mFrameCount = 0;
+};
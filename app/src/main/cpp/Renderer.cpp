@@ -19,10 +19,13 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
 #include <algorithm>
+#include <iterator>
+#include <thread>
+
+#ifndef __ANDROID__
+#include <fstream>
+#endif
 
 #include "Utils.h"
 
@@ -31,99 +34,218 @@ struct PushConstantBlock {
     glm::mat2 preRotate;
 };
 
+struct ChecksumPushConstantBlock {
+    uint32_t width;
+    uint32_t height;
+    uint32_t isBgra;
+};
+
+struct YuvPushConstantBlock {
+    uint32_t imageWidth;
+    uint32_t imageHeight;
+    uint32_t width;
+    uint32_t height;
+    uint32_t isBgra;
+    uint32_t rotation;
+    uint32_t isI420;
+};
+
+// Written by checksum.comp, the only part of a frame that is read back
+struct ChecksumBlock {
+    uint32_t hash;
+    // First and last pixel of the top row, 10 rows above and below the middle and the bottom row
+    uint32_t samples[8];
+    // Luma histogram with 8 levels per bin
+    uint32_t histogram[32];
+};
+
+// Clockwise quarter turns the renderer applies for a pre-rotation
+static uint32_t getQuarterTurns(VkSurfaceTransformFlagBitsKHR preTransform) {
+    switch (preTransform) {
+        case VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR:
+            return 1;
+        case VK_SURFACE_TRANSFORM_ROTATE_180_BIT_KHR:
+            return 2;
+        case VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
 /* Public APIs start here */
+#ifdef __ANDROID__
 void Renderer::initialize(ANativeWindow* window, AAssetManager* assetManager) {
     ASSERT(assetManager);
     mAssetManager = assetManager;
 
+    createResources(window);
+}
+#else
+void Renderer::initializeHeadless(uint32_t width, uint32_t height, const char* assetDirectory) {
+    ASSERT(width && height && assetDirectory);
+    mAssetDirectory = assetDirectory;
+    mHeadlessWidth = width;
+    mHeadlessHeight = height;
+
+    createResources(nullptr);
+}
+
+void Renderer::setHeadlessSurface(uint32_t width, uint32_t height,
+                                  VkSurfaceTransformFlagBitsKHR transform) {
+    if (mHeadlessWidth != width || mHeadlessHeight != height || mHeadlessTransform != transform) {
+        mHeadlessWidth = width;
+        mHeadlessHeight = height;
+        mHeadlessTransform = transform;
+        mFireRecreateSwapchain = true;
+    }
+}
+#endif
+
+void Renderer::createResources(ANativeWindow* window) {
+    // A profile selected before the window existed needs no swapchain recreation
+    mLatencyProfile = mPendingLatencyProfile;
+    mFireRecreateSwapchain = false;
+
     createInstance();
     createDevice();
+    createTimelineSemaphore();
     createSurface(window);
     createSwapchain(VK_NULL_HANDLE);
     createTextures();
     createDescriptorSet();
     createRenderPass();
     createGraphicsPipeline();
+    createComputePipelines();
     createVertexBuffer();
-    createCommandBuffers();
-    createSemaphores();
-    createFences();
+    createCommandPool();
+    createFrameContexts(getLatencyProfileInfo(mLatencyProfile).inflight);
 }
 
-void Renderer::drawFrame() {
-    // mInflightFences are created in the signaled state, so we can wait here from the beginning.
-    const uint32_t frameIndex = mFrameCount % kInflight;
-    ASSERT(mVk.WaitForFences(mDevice, 1, &mInflightFences[frameIndex], VK_TRUE, kTimeout30Sec) ==
-           VK_SUCCESS);
+bool Renderer::drawFrame() {
+    if (!isFrameNeeded()) {
+        mSkippedFrameCount++;
+        return false;
+    }
+    mIdleFrameCount = 0;
+    // Set again if this frame recreates the swapchain
+    mIsContentDirty = false;
+
+    const uint32_t frameIndex = mFrameCount % mFrames.size();
+    FrameContext& frame = mFrames[frameIndex];
+
+    // Each stage is timed from the end of the previous one
+    int64_t stageStartNanos = FrameProfiler::getNowNanos();
+    auto endStage = [&](FrameProfiler::Stage stage) {
+        const int64_t nowNanos = FrameProfiler::getNowNanos();
+        mProfiler->addSample(stage, nowNanos - stageStartNanos);
+        stageStartNanos = nowNanos;
+    };
 
-    // Need to reset fences to unsignaled state for vkQueueSubmit
-    ASSERT(mVk.ResetFences(mDevice, 1, &mInflightFences[frameIndex]) == VK_SUCCESS);
+    // Only wait for the submission that last used this frame context, which was issued a full ring
+    // of frames ago
+    waitForSerial(frame.serial);
+    endStage(FrameProfiler::Stage::kFenceWait);
+
+    // The GPU is done with this context, so the readback and timestamps recorded in it are ready
+    readTimestamps(&frame);
+    readbackFrame(&frame);
+    readbackRecording(&frame);
+    streamTextures();
+
+    // A recorded frame needs a free slot. Without one the frame is dropped from the recording
+    // rather than waiting for the sink. The same goes for a slot there's no memory left for.
+    int32_t recordingSlot = mFrameRecorder->isRecording() ? mFrameRecorder->acquireSlot() : -1;
+    if (recordingSlot >= 0 && !prepareRecordingSlot(recordingSlot)) {
+        mFrameRecorder->dropSlot(recordingSlot);
+        recordingSlot = -1;
+    }
+    bool isScreenshot = mIsScreenshotRequested;
+    Readback readback = getReadback();
+    if (recordingSlot >= 0 && readback == Readback::kNone) {
+        readback = Readback::kCopy;
+    }
+
+    // The offscreen copy follows the swapchain extent, and is only safe to replace at this point.
+    // It's only allocated once a frame actually reads back.
+    if (readback != Readback::kNone &&
+        (frame.copyWidth != mImageWidth || frame.copyHeight != mImageHeight)) {
+        destroyReadbackBuffer(&frame);
+        createReadbackBuffer(&frame);
+    }
+    // Screenshots and verification are optional, so close to the memory budget the frame only
+    // reads back what's left
+    if ((readback == Readback::kCapture || readback == Readback::kVerify) &&
+        frame.captureBuffer == VK_NULL_HANDLE && !createCaptureBuffer(&frame)) {
+        ALOGD("%s[%u] - no memory left to capture the frame", __FUNCTION__, mFrameCount);
+        isScreenshot = false;
+        if (readback == Readback::kCapture) {
+            readback = Readback::kChecksum;
+        } else {
+            readback = recordingSlot >= 0 ? Readback::kCopy : Readback::kNone;
+        }
+    }
+    endStage(FrameProfiler::Stage::kReadback);
 
     uint32_t imageIndex;
-    ASSERT(mVk.AcquireNextImageKHR(mDevice, mSwapchain, UINT64_MAX, mAcquireSemaphores[frameIndex],
+    ASSERT(mVk.AcquireNextImageKHR(mDevice, mSwapchain, UINT64_MAX, frame.acquireSemaphore,
                                    VK_NULL_HANDLE, &imageIndex) == VK_SUCCESS);
 
+    // Images can be acquired out of order, so another in-flight frame may still be rendering to
+    // this image. Wait for that frame before recording into it again.
+    waitForSerial(mImageSerials[imageIndex]);
+    endStage(FrameProfiler::Stage::kAcquire);
+
+    // Need to reset fences to unsignaled state for vkQueueSubmit
+    if (!mUseTimeline) {
+        ASSERT(mVk.ResetFences(mDevice, 1, &frame.inflightFence) == VK_SUCCESS);
+    }
+
     // Lazy allocate VkImageView and VkFramebuffer only when needed, and reuse later
     if (mFramebuffers[imageIndex] == VK_NULL_HANDLE) {
         createFramebuffer(imageIndex);
     }
 
-    recordCommandBuffer(frameIndex, imageIndex);
-
-    const VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    const VkSubmitInfo submitInfo = {
-            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .pNext = nullptr,
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &mAcquireSemaphores[frameIndex],
-            .pWaitDstStageMask = &waitStageMask,
-            .commandBufferCount = 1,
-            .pCommandBuffers = &mCommandBuffers[frameIndex],
-            .signalSemaphoreCount = 1,
-            .pSignalSemaphores = &mRenderSemaphores[frameIndex],
-    };
-    ASSERT(mVk.QueueSubmit(mQueue, 1, &submitInfo, mInflightFences[frameIndex]) == VK_SUCCESS);
-
-    ASSERT(mVk.WaitForFences(mDevice, 1, &mInflightFences[frameIndex], VK_TRUE, kTimeout30Sec) ==
-           VK_SUCCESS);
-
-    if (mFrameCount < mImages.size() || (mFrameCount + 1) % kLogInterval == 0) {
-        void* textureData;
-        ASSERT(mVk.MapMemory(mDevice, mStageMemory, 0, mStageMemoryRequirements.size, 0,
-                             &textureData) == VK_SUCCESS);
-
-        auto* data = static_cast<uint32_t*>(textureData);
-        uint32_t r0 = 0;
-        uint32_t r1 = (mImageHeight / 2 - 10) * mStageSubresourceLayout.rowPitch / 4;
-        uint32_t r2 = (mImageHeight / 2 + 10) * mStageSubresourceLayout.rowPitch / 4;
-        uint32_t r3 = (mImageHeight - 1) * mStageSubresourceLayout.rowPitch / 4;
-        ALOGD("READ BACK:\n%X %X\n%X %X\n%X %X\n%X %X",
-              data[r0], data[r0 + mImageWidth - 1],
-              data[r1], data[r1 + mImageWidth - 1],
-              data[r2], data[r2 + mImageWidth - 1],
-              data[r3], data[r3 + mImageWidth - 1]);
-
-        mVk.UnmapMemory(mDevice, mStageMemory);
-    }
+    const VkCommandBuffer commandBuffer = getCommandBuffer(&frame, imageIndex, readback);
+    const VkCommandBuffer recordingCommandBuffer =
+            recordingSlot >= 0 ? getRecordingCommandBuffer(&frame, recordingSlot, readback)
+                               : VK_NULL_HANDLE;
+    frame.frameNumber = mFrameCount;
+    frame.readback = readback;
+    frame.isVerified = mIsVerifyingFrames && isFrameVerifiable();
+    frame.capturePreTransform = mPreTransform;
+    frame.isScreenshot = isScreenshot;
+    frame.recordingSlot = recordingSlot;
+    mSwapchainFrameCount++;
+    frame.hasTimestamps = mHasTimestamps;
+    endStage(FrameProfiler::Stage::kRecord);
+
+    // The YUV conversion is left out of what presentation waits for
+    frame.serial = queueSubmit(commandBuffer, frame.acquireSemaphore,
+                               VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, frame.renderSemaphore,
+                               frame.inflightFence, recordingCommandBuffer);
+    mImageSerials[imageIndex] = frame.serial;
+    endStage(FrameProfiler::Stage::kSubmit);
 
     const VkPresentInfoKHR presentInfo = {
             .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
             .pNext = nullptr,
             .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &mRenderSemaphores[frameIndex],
+            .pWaitSemaphores = &frame.renderSemaphore,
             .swapchainCount = 1,
             .pSwapchains = &mSwapchain,
             .pImageIndices = &imageIndex,
             .pResults = nullptr,
     };
     VkResult ret = mVk.QueuePresentKHR(mQueue, &presentInfo);
+    endStage(FrameProfiler::Stage::kPresent);
 
-    // If there's old swapchain to be destroyed, check if we have reached the retire frame count
-    if (mOldSwapchain != VK_NULL_HANDLE && mRetireFrame == mFrameCount) {
+    // If there's old swapchain to be destroyed, check if the last frame rendering to it is done
+    if (mOldSwapchain != VK_NULL_HANDLE && isSerialComplete(mRetireSerial)) {
         destroyOldSwapchain();
     }
 
-    // VK_SUBOPTIMAL_KHR shouldn't occur again within kInflight frames in the real world. If that
+    // VK_SUBOPTIMAL_KHR shouldn't occur again within inflight frames in the real world. If that
     // happens, will switch to an array later to save the old swapchain stuff
     if (ret == VK_SUBOPTIMAL_KHR || mFireRecreateSwapchain) {
         // mFireRecreateSwapchain usually comes 3 to 4 frames later after 90 degree rotation, but we
@@ -132,14 +254,25 @@ void Renderer::drawFrame() {
             mPreRotationLatency = kPreRotationLatency;
             mFireRecreateSwapchain = false;
             ALOGD("%s[%u][%d] - recreate swapchain", __FUNCTION__, mFrameCount, ret);
+            if (mOldSwapchain != VK_NULL_HANDLE) {
+                waitForSerial(mRetireSerial);
+                destroyOldSwapchain();
+            }
             std::swap(mSwapchain, mOldSwapchain);
             std::swap(mImages, mOldImages);
             std::swap(mImageViews, mOldImageViews);
             std::swap(mFramebuffers, mOldFramebuffers);
-            mVk.FreeMemory(mDevice, mStageMemory, nullptr);
-            mVk.DestroyImage(mDevice, mStageImage, nullptr);
 
-            mRetireFrame = mFrameCount + kInflight;
+            // Resizing the frame ring is rare enough to simply drain the queue first
+            if (mPendingLatencyProfile != mLatencyProfile) {
+                mLatencyProfile = mPendingLatencyProfile;
+                mVk.DeviceWaitIdle(mDevice);
+                mCompletedSerial = mSubmitSerial;
+                destroyFrameContexts();
+                createFrameContexts(getLatencyProfileInfo(mLatencyProfile).inflight);
+            }
+
+            mRetireSerial = mSubmitSerial;
 
             // Recreate the new swapchain with the latest preTransform. Numbers of swapchain images,
             // image views and framebuffers are also allowed to change. Even the aspect ratio of the
@@ -152,8 +285,14 @@ void Renderer::drawFrame() {
 
     // Increase the frame count here and log at a frame interval
     if (++mFrameCount % kLogInterval == 0) {
-        ALOGD("%s[%u][%d]", __FUNCTION__, mFrameCount, ret);
+        ALOGD("%s[%u][%d] skipped[%u]", __FUNCTION__, mFrameCount, ret, mSkippedFrameCount);
+    }
+    if (mFrameCount % kProfileLogInterval == 0) {
+        mProfiler->logSummaries();
+        mMemoryAllocator.updateBudget();
+        mResourceTracker->logStats();
     }
+    return true;
 }
 
 void Renderer::updateSurface(uint32_t width, uint32_t height) {
@@ -162,38 +301,97 @@ void Renderer::updateSurface(uint32_t width, uint32_t height) {
     }
 }
 
+void Renderer::setLatencyProfile(LatencyProfile profile) {
+    if (profile != mPendingLatencyProfile) {
+        mPendingLatencyProfile = profile;
+        mFireRecreateSwapchain = true;
+    }
+}
+
+void Renderer::setIdleFrameSkipping(bool enabled, uint32_t forcedFrameInterval) {
+    ALOGD("%s: %d, %u", __FUNCTION__, enabled, forcedFrameInterval);
+    mSkipIdleFrames = enabled;
+    mForcedFrameInterval = forcedFrameInterval;
+    mIdleFrameCount = 0;
+}
+
+void Renderer::setReadbackPolicy(ReadbackPolicy policy, uint32_t interval) {
+    ALOGD("%s: %d, %u", __FUNCTION__, static_cast<int>(policy), interval);
+    mReadbackPolicy = policy;
+    // An interval of 0 reads back every frame, like 1 does
+    mReadbackInterval = std::max(interval, 1U);
+}
+
+void Renderer::requestReadback() {
+    mIsReadbackRequested = true;
+}
+
+void Renderer::requestScreenshot() {
+    mIsScreenshotRequested = true;
+}
+
+void Renderer::setFrameVerification(bool enabled, uint8_t tolerance) {
+    ALOGD("%s: %d, %u", __FUNCTION__, enabled, tolerance);
+    mIsVerifyingFrames = enabled;
+    mFrameVerifier.setTolerance(tolerance);
+    mVerificationStats = {};
+}
+
+void Renderer::startRecording(std::unique_ptr<FrameSink> sink, YuvFormat format) {
+    ALOGD("%s: %d", __FUNCTION__, static_cast<int>(format));
+    stopRecording();
+    if (format != mYuvFormat) {
+        mYuvFormat = format;
+        mCommandGeneration++;
+    }
+    mFrameRecorder->start(std::move(sink));
+}
+
+void Renderer::stopRecording() {
+    if (!mFrameRecorder->isRecording()) {
+        return;
+    }
+
+    for (auto& frame : mFrames) {
+        if (frame.recordingSlot >= 0) {
+            waitForSerial(frame.serial);
+            readbackRecording(&frame);
+        }
+    }
+    mFrameRecorder->stop();
+}
+
 void Renderer::destroy() {
     if (mDevice != VK_NULL_HANDLE) {
+        mTextureLoader.stop();
+        stopRecording();
         mVk.DeviceWaitIdle(mDevice);
 
-        // Destroy sync objects
-        for (auto& fence : mInflightFences) {
-            mVk.DestroyFence(mDevice, fence, nullptr);
-        }
-        mInflightFences.clear();
-        for (auto& semaphore : mAcquireSemaphores) {
-            mVk.DestroySemaphore(mDevice, semaphore, nullptr);
-        }
-        mAcquireSemaphores.clear();
-        for (auto& semaphore : mRenderSemaphores) {
-            mVk.DestroySemaphore(mDevice, semaphore, nullptr);
-        }
-        mRenderSemaphores.clear();
-
-        // Destroy command buffers
-        if (!mCommandBuffers.empty()) {
-            mVk.FreeCommandBuffers(mDevice, mCommandPool, mCommandBuffers.size(),
-                                   mCommandBuffers.data());
-        }
-        mCommandBuffers.clear();
+        // Destroy frame contexts and the recording slots they convert into
+        destroyFrameContexts();
+        destroyRecordingSlots();
         mVk.DestroyCommandPool(mDevice, mCommandPool, nullptr);
         mCommandPool = VK_NULL_HANDLE;
+        mRecordingWorkers.reset();
+        mRecordingJobCount = 0;
 
         // Destroy vertex buffer
-        mVk.DestroyBuffer(mDevice, mVertexBuffer, nullptr);
-        mVertexBuffer = VK_NULL_HANDLE;
-        mVk.FreeMemory(mDevice, mVertexMemory, nullptr);
-        mVertexMemory = VK_NULL_HANDLE;
+        destroyBuffer(&mVertexBuffer, &mVertexMemory);
+        mDraws.clear();
+
+        // Destroy compute pipelines
+        mVk.DestroyPipeline(mDevice, mChecksumPipeline, nullptr);
+        mChecksumPipeline = VK_NULL_HANDLE;
+        mVk.DestroyPipelineLayout(mDevice, mChecksumPipelineLayout, nullptr);
+        mChecksumPipelineLayout = VK_NULL_HANDLE;
+        mVk.DestroyDescriptorSetLayout(mDevice, mChecksumSetLayout, nullptr);
+        mChecksumSetLayout = VK_NULL_HANDLE;
+        mVk.DestroyPipeline(mDevice, mYuvPipeline, nullptr);
+        mYuvPipeline = VK_NULL_HANDLE;
+        mVk.DestroyPipelineLayout(mDevice, mYuvPipelineLayout, nullptr);
+        mYuvPipelineLayout = VK_NULL_HANDLE;
+        mVk.DestroyDescriptorSetLayout(mDevice, mYuvSetLayout, nullptr);
+        mYuvSetLayout = VK_NULL_HANDLE;
 
         // Destroy graphics pipeline
         mVk.DestroyPipeline(mDevice, mPipeline, nullptr);
@@ -205,38 +403,57 @@ void Renderer::destroy() {
         mVk.DestroyRenderPass(mDevice, mRenderPass, nullptr);
         mRenderPass = VK_NULL_HANDLE;
 
-        // Destroy descriptor sets
-        mVk.FreeDescriptorSets(mDevice, mDescriptorPool, 1, &mDescriptorSet);
+        // Destroy descriptor sets, the pool frees every set allocated from it
         mVk.DestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
+        mDescriptorPool = VK_NULL_HANDLE;
+        mDescriptorSet = VK_NULL_HANDLE;
         mVk.DestroyDescriptorSetLayout(mDevice, mDescriptorSetLayout, nullptr);
+        mDescriptorSetLayout = VK_NULL_HANDLE;
 
-        // Destroy textures
+        // Destroy textures and the uploads still holding on to staging memory
+        for (auto& batch : mUploadBatches) {
+            destroyUploadBatch(&batch);
+        }
+        mUploadBatches.clear();
+        mVk.DestroyCommandPool(mDevice, mUploadCommandPool, nullptr);
+        mUploadCommandPool = VK_NULL_HANDLE;
         for (auto& texture : mTextures) {
-            mVk.DestroyImageView(mDevice, texture.view, nullptr);
-            mVk.DestroySampler(mDevice, texture.sampler, nullptr);
-            mVk.DestroyImage(mDevice, texture.image, nullptr);
-            mVk.FreeMemory(mDevice, texture.memory, nullptr);
+            destroyTexture(&texture);
         }
         mTextures.clear();
+        destroyTexture(&mPlaceholderTexture);
+        mResidentTextureCount = 0;
 
         // Destroy old swapchain
         destroyOldSwapchain();
 
         // Destroy current swapchain
-        for (auto& imageView : mImageViews) {
-            mVk.DestroyImageView(mDevice, imageView, nullptr);
-        }
-        mImageViews.clear();
-        for (auto& framebuffer : mFramebuffers) {
-            mVk.DestroyFramebuffer(mDevice, framebuffer, nullptr);
-        }
-        mFramebuffers.clear();
+        destroyFramebuffers(&mImageViews, &mFramebuffers);
+        mImageSerials.clear();
         mImages.clear();
         mVk.DestroySwapchainKHR(mDevice, mSwapchain, nullptr);
+        mResourceTracker->onDestroy(ResourceTracker::Resource::kSwapchain);
+        mSwapchain = VK_NULL_HANDLE;
+
+        // Destroy timeline semaphore
+        mVk.DestroySemaphore(mDevice, mTimeline, nullptr);
+        mTimeline = VK_NULL_HANDLE;
+        mSubmitSerial = 0;
+        mCompletedSerial = 0;
 
         // Destroy device
+        mMemoryAllocator.destroy();
         mVk.DestroyDevice(mDevice, nullptr);
         mDevice = VK_NULL_HANDLE;
+
+        // Everything created with the device must be gone with it
+        const ResourceTracker::Stats resourceStats = mResourceTracker->getStats();
+        for (uint32_t i = 0; i < static_cast<uint32_t>(ResourceTracker::Resource::kCount); i++) {
+            if (resourceStats.counts[i].live) {
+                ALOGD("%s - %u %s leaked", __FUNCTION__, resourceStats.counts[i].live,
+                      ResourceTracker::getResourceName(static_cast<ResourceTracker::Resource>(i)));
+            }
+        }
     }
 
     if (mInstance) {
@@ -269,6 +486,38 @@ static bool hasExtension(const char* extensionName,
                         }) != extensions.cend();
 }
 
+const Renderer::LatencyProfileInfo& Renderer::getLatencyProfileInfo(LatencyProfile profile) {
+    static const LatencyProfileInfo kLowLatencyInfo = {
+            .presentModes = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+                             VK_PRESENT_MODE_FIFO_KHR},
+            .presentModeCount = 3,
+            .imageCount = 0,
+            .inflight = 1,
+    };
+    static const LatencyProfileInfo kBalancedInfo = {
+            .presentModes = {VK_PRESENT_MODE_FIFO_KHR},
+            .presentModeCount = 1,
+            .imageCount = 3,
+            .inflight = 2,
+    };
+    static const LatencyProfileInfo kThroughputInfo = {
+            .presentModes = {VK_PRESENT_MODE_FIFO_KHR},
+            .presentModeCount = 1,
+            .imageCount = 4,
+            .inflight = 3,
+    };
+
+    switch (profile) {
+        case LatencyProfile::kLowLatency:
+            return kLowLatencyInfo;
+        case LatencyProfile::kThroughput:
+            return kThroughputInfo;
+        case LatencyProfile::kBalanced:
+        default:
+            return kBalancedInfo;
+    }
+}
+
 void Renderer::createInstance() {
     mVk.initializeGlobalApi();
 
@@ -282,6 +531,13 @@ void Renderer::createInstance() {
     ASSERT(mVk.EnumerateInstanceLayerProperties(&layerCount, supportedInstanceLayers.data()) == VK_SUCCESS);
     std::vector<const char*> enabledInstanceLayers;
     for (const auto layer : kRequiredInstanceLayers) {
+#ifndef __ANDROID__
+        // Host machines, e.g. CI runners, may not have the validation layers installed
+        if (!hasLayer(layer, supportedInstanceLayers)) {
+            ALOGD("Layer %s is not available", layer);
+            continue;
+        }
+#endif
         ASSERT(hasLayer(layer, supportedInstanceLayers));
         enabledInstanceLayers.push_back(layer);
     }
@@ -348,6 +604,43 @@ void Renderer::createDevice() {
         enabledDeviceExtensions.push_back(extension);
     }
 
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+            .pNext = nullptr,
+            .timelineSemaphore = VK_FALSE,
+    };
+    mUseTimeline = false;
+    if (kPreferTimelineSemaphore &&
+        hasExtension(kTimelineSemaphoreExtension, supportedDeviceExtensions)) {
+        VkPhysicalDeviceFeatures2 features2 = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &timelineSemaphoreFeatures,
+        };
+        mVk.GetPhysicalDeviceFeatures2(mGpu, &features2);
+        if (timelineSemaphoreFeatures.timelineSemaphore == VK_TRUE) {
+            enabledDeviceExtensions.push_back(kTimelineSemaphoreExtension);
+            mUseTimeline = true;
+        }
+    }
+    ALOGD("Timeline semaphore backend: %s", mUseTimeline ? "enabled" : "disabled");
+
+    const bool hasMemoryBudget = hasExtension(kMemoryBudgetExtension, supportedDeviceExtensions);
+    if (hasMemoryBudget) {
+        enabledDeviceExtensions.push_back(kMemoryBudgetExtension);
+    }
+    ALOGD("Memory budget: %s", hasMemoryBudget ? "queried" : "estimated from the heap sizes");
+
+    // Compressed textures are used where supported, and otherwise decoded on the CPU
+    VkPhysicalDeviceFeatures supportedFeatures;
+    mVk.GetPhysicalDeviceFeatures(mGpu, &supportedFeatures);
+    mEnabledFeatures = {};
+    for (const auto& compressedFormat : kCompressedFormats) {
+        mEnabledFeatures.*compressedFormat.feature = supportedFeatures.*compressedFormat.feature;
+    }
+    ALOGD("Texture compression: ASTC[%u] ETC2[%u] BC[%u]",
+          mEnabledFeatures.textureCompressionASTC_LDR, mEnabledFeatures.textureCompressionETC2,
+          mEnabledFeatures.textureCompressionBC);
+
     uint32_t queueFamilyCount = 0;
     mVk.GetPhysicalDeviceQueueFamilyProperties(mGpu, &queueFamilyCount, nullptr);
     ASSERT(queueFamilyCount);
@@ -356,9 +649,12 @@ void Renderer::createDevice() {
     mVk.GetPhysicalDeviceQueueFamilyProperties(mGpu, &queueFamilyCount,
                                                queueFamilyProperties.data());
 
+    // The frame checksum is computed on the same queue that renders the frame
+    const VkQueueFlags requiredQueueFlags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
     uint32_t queueFamilyIndex;
     for (queueFamilyIndex = 0; queueFamilyIndex < queueFamilyCount; ++queueFamilyIndex) {
-        if (queueFamilyProperties[queueFamilyIndex].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        if ((queueFamilyProperties[queueFamilyIndex].queueFlags & requiredQueueFlags) ==
+            requiredQueueFlags) {
             break;
         }
     }
@@ -366,6 +662,23 @@ void Renderer::createDevice() {
     mQueueFamilyIndex = queueFamilyIndex;
     ALOGD("queueFamilyIndex = %u", queueFamilyIndex);
 
+#ifdef __ANDROID__
+    // Swapchain images are acquired from and released to the compositor
+    mExternalQueueFamilyIndex = VK_QUEUE_FAMILY_FOREIGN_EXT;
+#else
+    // Headless images are never used outside of our queue, so no ownership transfer is needed
+    mExternalQueueFamilyIndex = mQueueFamilyIndex;
+#endif
+
+    VkPhysicalDeviceProperties gpuProperties;
+    mVk.GetPhysicalDeviceProperties(mGpu, &gpuProperties);
+    const uint32_t timestampValidBits = queueFamilyProperties[queueFamilyIndex].timestampValidBits;
+    mHasTimestamps = timestampValidBits != 0 && gpuProperties.limits.timestampPeriod > 0.0F;
+    mTimestampPeriod = gpuProperties.limits.timestampPeriod;
+    mTimestampMask = timestampValidBits < 64 ? (1ULL << timestampValidBits) - 1 : UINT64_MAX;
+    ALOGD("GPU timestamps: %s, period = %fns", mHasTimestamps ? "enabled" : "disabled",
+          mTimestampPeriod);
+
     const float priority = 1.0F;
     const VkDeviceQueueCreateInfo queueCreateInfo = {
             .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
@@ -377,17 +690,18 @@ void Renderer::createDevice() {
     };
     const VkDeviceCreateInfo deviceCreateInfo = {
             .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-            .pNext = nullptr,
+            .pNext = mUseTimeline ? &timelineSemaphoreFeatures : nullptr,
             .queueCreateInfoCount = 1,
             .pQueueCreateInfos = &queueCreateInfo,
             .enabledLayerCount = 0,
             .ppEnabledLayerNames = nullptr,
             .enabledExtensionCount = static_cast<uint32_t>(enabledDeviceExtensions.size()),
             .ppEnabledExtensionNames = enabledDeviceExtensions.data(),
-            .pEnabledFeatures = nullptr,
+            .pEnabledFeatures = &mEnabledFeatures,
     };
     ASSERT(mVk.CreateDevice(mGpu, &deviceCreateInfo, nullptr, &mDevice) == VK_SUCCESS);
     mVk.initializeDeviceApi(mDevice);
+    mMemoryAllocator.initialize(&mVk, mGpu, mDevice, hasMemoryBudget, mResourceTracker);
 
     mVk.GetDeviceQueue(mDevice, mQueueFamilyIndex, 0, &mQueue);
 
@@ -395,6 +709,7 @@ void Renderer::createDevice() {
 }
 
 void Renderer::createSurface(ANativeWindow* window) {
+#ifdef __ANDROID__
     ASSERT(window);
 
     const VkAndroidSurfaceCreateInfoKHR surfaceInfo = {
@@ -404,6 +719,17 @@ void Renderer::createSurface(ANativeWindow* window) {
             .window = window,
     };
     ASSERT(mVk.CreateAndroidSurfaceKHR(mInstance, &surfaceInfo, nullptr, &mSurface) == VK_SUCCESS);
+#else
+    ASSERT(!window);
+
+    const VkHeadlessSurfaceCreateInfoEXT surfaceInfo = {
+            .sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+            .pNext = nullptr,
+            .flags = 0,
+    };
+    ASSERT(mVk.CreateHeadlessSurfaceEXT(mInstance, &surfaceInfo, nullptr, &mSurface) ==
+           VK_SUCCESS);
+#endif
 
     VkBool32 surfaceSupported = VK_FALSE;
     ASSERT(mVk.GetPhysicalDeviceSurfaceSupportKHR(mGpu, mQueueFamilyIndex, mSurface,
@@ -423,17 +749,44 @@ void Renderer::createSurface(ANativeWindow* window) {
             break;
         }
     }
+    // Desktop drivers, e.g. for headless surfaces, may only expose BGRA
+    if (formatIndex == formatCount) {
+        for (formatIndex = 0; formatIndex < formatCount; ++formatIndex) {
+            if (formats[formatIndex].format == VK_FORMAT_B8G8R8A8_UNORM) {
+                break;
+            }
+        }
+    }
     ASSERT(formatIndex < formatCount);
     mFormat = formats[formatIndex].format;
     mColorSpace = formats[formatIndex].colorSpace;
 
+    uint32_t presentModeCount = 0;
+    ASSERT(mVk.GetPhysicalDeviceSurfacePresentModesKHR(mGpu, mSurface, &presentModeCount,
+                                                       nullptr) == VK_SUCCESS);
+    mPresentModes.resize(presentModeCount);
+    ASSERT(mVk.GetPhysicalDeviceSurfacePresentModesKHR(mGpu, mSurface, &presentModeCount,
+                                                       mPresentModes.data()) == VK_SUCCESS);
+
     ALOGD("Successfully created surface");
 }
 
+void Renderer::getSurfaceCapabilities(VkSurfaceCapabilitiesKHR* outCapabilities) {
+    ASSERT(mVk.GetPhysicalDeviceSurfaceCapabilitiesKHR(mGpu, mSurface, outCapabilities) ==
+           VK_SUCCESS);
+
+#ifndef __ANDROID__
+    // A headless surface has no extent of its own and never rotates, so report the scripted state
+    // as if a display had been rotated
+    outCapabilities->currentExtent.width = mHeadlessWidth;
+    outCapabilities->currentExtent.height = mHeadlessHeight;
+    outCapabilities->currentTransform = mHeadlessTransform;
+#endif
+}
+
 void Renderer::createSwapchain(VkSwapchainKHR oldSwapchain) {
     VkSurfaceCapabilitiesKHR surfaceCapabilities;
-    ASSERT(mVk.GetPhysicalDeviceSurfaceCapabilitiesKHR(mGpu, mSurface, &surfaceCapabilities) ==
-           VK_SUCCESS);
+    getSurfaceCapabilities(&surfaceCapabilities);
     ALOGD("Current surface size: %dx%d\n", surfaceCapabilities.currentExtent.width,
           surfaceCapabilities.currentExtent.height);
     ALOGD("Current transform: 0x%x\n", surfaceCapabilities.currentTransform);
@@ -447,56 +800,40 @@ void Renderer::createSwapchain(VkSwapchainKHR oldSwapchain) {
         std::swap(mImageWidth, mImageHeight);
     }
 
-    VkImageCreateInfo imageCreateInfo = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-            .pNext = nullptr,
-            .flags = 0,
-            .imageType = VK_IMAGE_TYPE_2D,
-            .format = VK_FORMAT_R8G8B8A8_UNORM,
-            .extent =
-                    {
-                            .width = mImageWidth,
-                            .height = mImageHeight,
-                            .depth = 1,
-                    },
-            .mipLevels = 1,
-            .arrayLayers = 1,
-            .samples = VK_SAMPLE_COUNT_1_BIT,
-            .tiling = VK_IMAGE_TILING_LINEAR,
-            .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-            .queueFamilyIndexCount = 1,
-            .pQueueFamilyIndices = &mQueueFamilyIndex,
-            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-    };
-    ASSERT(mVk.CreateImage(mDevice, &imageCreateInfo, nullptr, &mStageImage) == VK_SUCCESS);
+    const LatencyProfileInfo& profileInfo = getLatencyProfileInfo(mLatencyProfile);
+    mPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    for (uint32_t i = 0; i < profileInfo.presentModeCount; i++) {
+        if (std::find(mPresentModes.cbegin(), mPresentModes.cend(), profileInfo.presentModes[i]) !=
+            mPresentModes.cend()) {
+            mPresentMode = profileInfo.presentModes[i];
+            break;
+        }
+    }
 
-    mVk.GetImageMemoryRequirements(mDevice, mStageImage, &mStageMemoryRequirements);
+    uint32_t minImageCount = std::max(profileInfo.imageCount, surfaceCapabilities.minImageCount);
+    if (surfaceCapabilities.maxImageCount) {
+        minImageCount = std::min(minImageCount, surfaceCapabilities.maxImageCount);
+    }
+    ALOGD("Present mode = %d, min image count = %u", mPresentMode, minImageCount);
 
-    const uint32_t typeIndex = getMemoryTypeIndex(mStageMemoryRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-    VkMemoryAllocateInfo memoryAllocateInfo = {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .pNext = nullptr,
-            .allocationSize = mStageMemoryRequirements.size,
-            .memoryTypeIndex = typeIndex,
-    };
-    ASSERT(mVk.AllocateMemory(mDevice, &memoryAllocateInfo, nullptr, &mStageMemory) == VK_SUCCESS);
-    ASSERT(mVk.BindImageMemory(mDevice, mStageImage, mStageMemory, 0) == VK_SUCCESS);
+    const VkCompositeAlphaFlagBitsKHR compositeAlpha =
+            (surfaceCapabilities.supportedCompositeAlpha & VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR)
+                    ? VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR
+                    : VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 
-    const VkImageSubresource imageSubresource = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .mipLevel = 0,
-            .arrayLayer = 0,
-    };
-    mVk.GetImageSubresourceLayout(mDevice, mStageImage, &imageSubresource, &mStageSubresourceLayout);
+#ifdef __ANDROID__
+    const VkSurfaceTransformFlagBitsKHR swapchainTransform = mPreTransform;
+#else
+    // The emulated rotation is applied by the renderer, the headless swapchain itself can't rotate
+    const VkSurfaceTransformFlagBitsKHR swapchainTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+#endif
 
     const VkSwapchainCreateInfoKHR swapchainCreateInfo = {
             .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
             .pNext = nullptr,
             .flags = 0,
             .surface = mSurface,
-            .minImageCount = kReqImageCount,
+            .minImageCount = minImageCount,
             .imageFormat = mFormat,
             .imageColorSpace = mColorSpace,
             .imageExtent =
@@ -509,14 +846,15 @@ void Renderer::createSwapchain(VkSwapchainKHR oldSwapchain) {
             .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
             .queueFamilyIndexCount = 1,
             .pQueueFamilyIndices = &mQueueFamilyIndex,
-            .preTransform = mPreTransform,
-            .compositeAlpha = VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR,
-            .presentMode = VK_PRESENT_MODE_FIFO_KHR,
+            .preTransform = swapchainTransform,
+            .compositeAlpha = compositeAlpha,
+            .presentMode = mPresentMode,
             .clipped = VK_FALSE,
             .oldSwapchain = oldSwapchain,
     };
     ASSERT(mVk.CreateSwapchainKHR(mDevice, &swapchainCreateInfo, nullptr, &mSwapchain) ==
            VK_SUCCESS);
+    mResourceTracker->onCreate(ResourceTracker::Resource::kSwapchain);
 
     uint32_t imageCount = 0;
     ASSERT(mVk.GetSwapchainImagesKHR(mDevice, mSwapchain, &imageCount, nullptr) == VK_SUCCESS);
@@ -528,37 +866,78 @@ void Renderer::createSwapchain(VkSwapchainKHR oldSwapchain) {
 
     mImageViews.resize(imageCount, VK_NULL_HANDLE);
     mFramebuffers.resize(imageCount, VK_NULL_HANDLE);
+    mImageSerials.assign(imageCount, 0);
+    mCommandGeneration++;
+    mIsContentDirty = true;
+    mSwapchainFrameCount = 0;
 
     ALOGD("Successfully created swapchain");
 }
 
-static std::vector<char> readFileFromAsset(AAssetManager* assetManager, const char* filePath,
-                                           int mode) {
+std::vector<char> Renderer::readAsset(const char* filePath, bool isOptional) {
     ASSERT(filePath);
 
-    AAsset* file = AAssetManager_open(assetManager, filePath, mode);
+#ifdef __ANDROID__
+    AAsset* file = AAssetManager_open(mAssetManager, filePath, AASSET_MODE_BUFFER);
+    if (!file && isOptional) {
+        return {};
+    }
     ASSERT(file);
 
     auto fileLength = (size_t)AAsset_getLength(file);
     std::vector<char> fileContent(fileLength);
     AAsset_read(file, fileContent.data(), fileLength);
     AAsset_close(file);
+#else
+    std::ifstream file(mAssetDirectory + "/" + filePath, std::ios::binary);
+    if (!file && isOptional) {
+        return {};
+    }
+    ASSERT(file);
+
+    std::vector<char> fileContent((std::istreambuf_iterator<char>(file)),
+                                  std::istreambuf_iterator<char>());
+#endif
 
     return fileContent;
 }
 
-uint32_t Renderer::getMemoryTypeIndex(uint32_t typeBits, VkFlags mask) {
-    VkPhysicalDeviceMemoryProperties memoryProperties;
-    mVk.GetPhysicalDeviceMemoryProperties(mGpu, &memoryProperties);
+bool Renderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage,
+                            VkBuffer* outBuffer, MemoryAllocator::Allocation* outMemory,
+                            bool isOptional) {
+    const VkBufferCreateInfo bufferCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .size = size,
+            .usage = usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 1,
+            .pQueueFamilyIndices = &mQueueFamilyIndex,
+    };
+    ASSERT(mVk.CreateBuffer(mDevice, &bufferCreateInfo, nullptr, outBuffer) == VK_SUCCESS);
+    mResourceTracker->onCreate(ResourceTracker::Resource::kBuffer);
+
+    MemoryAllocator::Requirements requirements;
+    mMemoryAllocator.getRequirements(*outBuffer, &requirements);
+    if (!isOptional) {
+        mMemoryAllocator.allocate(requirements, memoryUsage, outMemory);
+    } else if (!mMemoryAllocator.allocateOptional(requirements, memoryUsage, outMemory)) {
+        destroyBuffer(outBuffer, outMemory);
+        return false;
+    }
+    ASSERT(mVk.BindBufferMemory(mDevice, *outBuffer, outMemory->memory, outMemory->offset) ==
+           VK_SUCCESS);
+    return true;
+}
 
-    for (uint32_t typeIndex = 0; typeIndex < std::numeric_limits<uint32_t>::digits; typeIndex++) {
-        if ((typeBits & 1U) == 1 &&
-            (memoryProperties.memoryTypes[typeIndex].propertyFlags & mask) == mask) {
-            return typeIndex;
-        }
-        typeBits >>= 1U;
+void Renderer::destroyBuffer(VkBuffer* buffer, MemoryAllocator::Allocation* memory) {
+    if (*buffer != VK_NULL_HANDLE) {
+        mVk.DestroyBuffer(mDevice, *buffer, nullptr);
+        mResourceTracker->onDestroy(ResourceTracker::Resource::kBuffer);
+        *buffer = VK_NULL_HANDLE;
     }
-    ASSERT(false);
+    mMemoryAllocator.free(memory);
 }
 
 void Renderer::setImageLayout(VkCommandBuffer commandBuffer, VkImage image,
@@ -590,238 +969,464 @@ void Renderer::setImageLayout(VkCommandBuffer commandBuffer, VkImage image,
                            &imageMemoryBarrier);
 }
 
-void Renderer::loadTextureFromFile(const char* filePath, Texture* outTexture) {
-    std::vector<char> file = readFileFromAsset(mAssetManager, filePath, AASSET_MODE_BUFFER);
-    ASSERT(!file.empty());
+void Renderer::setTextureLayout(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseLevel,
+                                uint32_t levelCount, VkAccessFlags srcAccessMask,
+                                VkAccessFlags dstAccessMask, VkImageLayout oldImageLayout,
+                                VkImageLayout newImageLayout, VkPipelineStageFlags srcStageMask,
+                                VkPipelineStageFlags dstStageMask) {
+    const VkImageMemoryBarrier imageMemoryBarrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .pNext = nullptr,
+            .srcAccessMask = srcAccessMask,
+            .dstAccessMask = dstAccessMask,
+            .oldLayout = oldImageLayout,
+            .newLayout = newImageLayout,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = image,
+            .subresourceRange =
+                    {
+                            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                            .baseMipLevel = baseLevel,
+                            .levelCount = levelCount,
+                            .baseArrayLayer = 0,
+                            .layerCount = 1,
+                    },
+    };
+    mVk.CmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, 0, nullptr, 1,
+                           &imageMemoryBarrier);
+}
+
+bool Renderer::isTextureFormatSupported(VkFormat format) {
+    for (const auto& compressedFormat : kCompressedFormats) {
+        if (compressedFormat.format == format && !(mEnabledFeatures.*compressedFormat.feature)) {
+            return false;
+        }
+    }
 
     VkFormatProperties formatProperties;
-    mVk.GetPhysicalDeviceFormatProperties(mGpu, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
-    ASSERT(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+    mVk.GetPhysicalDeviceFormatProperties(mGpu, format, &formatProperties);
+    return (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+}
+
+VkDeviceSize Renderer::getStagingSize(const TextureLoader::Image& image) {
+    const auto alignUp = [](VkDeviceSize size) {
+        return (size + kStagingAlignment - 1) / kStagingAlignment * kStagingAlignment;
+    };
+    if (!image.isCompressed()) {
+        return alignUp(VkDeviceSize(image.width) * image.height * 4);
+    }
+
+    VkDeviceSize size = 0;
+    for (const auto& level : image.levels) {
+        size += alignUp(level.size);
+    }
+    return size;
+}
+
+void Renderer::recordTextureUpload(UploadBatch* batch, VkDeviceSize stagingOffset,
+                                   const TextureLoader::Image& image, Texture* outTexture) {
+    const uint32_t imageWidth = image.width;
+    const uint32_t imageHeight = image.height;
+    ASSERT(stagingOffset % kStagingAlignment == 0);
+    ASSERT(stagingOffset + getStagingSize(image) <= batch->stagingMemory.size);
+    ASSERT(isTextureFormatSupported(image.format));
+    uint8_t* stagingData = static_cast<uint8_t*>(batch->stagingMemory.data);
+
+    // Compressed blocks are copied level by level as they were stored. A decoded image is
+    // converted to tightly packed RGBA rows in a single pass, straight into the staging buffer.
+    std::vector<VkBufferImageCopy> copyInfos;
+    if (image.isCompressed()) {
+        for (const auto& level : image.levels) {
+            memcpy(stagingData + stagingOffset, image.data.data() + level.offset, level.size);
+            copyInfos.push_back({
+                    .bufferOffset = stagingOffset,
+                    .bufferRowLength = 0,
+                    .bufferImageHeight = 0,
+                    .imageSubresource = {
+                            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                            .mipLevel = static_cast<uint32_t>(copyInfos.size()),
+                            .baseArrayLayer = 0,
+                            .layerCount = 1,
+                            },
+                    .imageOffset = {
+                            .x = 0,
+                            .y = 0,
+                            .z = 0,
+                            },
+                    .imageExtent = {
+                            .width = level.width,
+                            .height = level.height,
+                            .depth = 1,
+                            },
+            });
+            stagingOffset += (level.size + kStagingAlignment - 1) / kStagingAlignment *
+                    kStagingAlignment;
+        }
+    } else {
+        TextureLoader::copyToRgba(image, stagingData + stagingOffset, size_t(imageWidth) * 4);
+        copyInfos.push_back({
+                .bufferOffset = stagingOffset,
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .mipLevel = 0,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                        },
+                .imageOffset = {
+                        .x = 0,
+                        .y = 0,
+                        .z = 0,
+                        },
+                .imageExtent = {
+                        .width = imageWidth,
+                        .height = imageHeight,
+                        .depth = 1,
+                        },
+        });
+    }
+    const auto copyCount = static_cast<uint32_t>(copyInfos.size());
+
+    // Compressed images bring their own mips. A decoded image gets the full chain down to 1x1,
+    // generated from level 0 if the format can be blitted with a linear filter.
+    uint32_t levelCount = copyCount;
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (!image.isCompressed() && mIsMipGenerationSupported) {
+        const uint32_t maxExtent = std::max(imageWidth, imageHeight);
+        while (maxExtent >> levelCount) {
+            levelCount++;
+        }
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
 
-    uint32_t imageWidth = 0;
-    uint32_t imageHeight = 0;
-    uint32_t channel = 0;
-    uint8_t* imageData =
-            stbi_load_from_memory((const stbi_uc*)file.data(), file.size(),
-                                  reinterpret_cast<int*>(&imageWidth),
-                                  reinterpret_cast<int*>(&imageHeight),
-                                  reinterpret_cast<int*>(&channel), 4 /*desired_channels*/);
-    ASSERT(imageData);
-    ASSERT(imageWidth);
-    ASSERT(imageHeight);
-    ASSERT(channel == 4);
-
-    // Create a stageImage and stageMemory for the original texture uploading
-    VkImage stageImage = VK_NULL_HANDLE;
-    VkDeviceMemory stageMemory = VK_NULL_HANDLE;
-    VkImageCreateInfo imageCreateInfo = {
+    // Create a tile texture to copy into
+    const VkImageCreateInfo imageCreateInfo = {
             .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
             .pNext = nullptr,
             .flags = 0,
             .imageType = VK_IMAGE_TYPE_2D,
-            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .format = image.format,
             .extent =
                     {
                             .width = imageWidth,
                             .height = imageHeight,
                             .depth = 1,
                     },
-            .mipLevels = 1,
+            .mipLevels = levelCount,
             .arrayLayers = 1,
             .samples = VK_SAMPLE_COUNT_1_BIT,
-            .tiling = VK_IMAGE_TILING_LINEAR,
-            .usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = usage,
             .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
             .queueFamilyIndexCount = 1,
             .pQueueFamilyIndices = &mQueueFamilyIndex,
-            .initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
     };
-    ASSERT(mVk.CreateImage(mDevice, &imageCreateInfo, nullptr, &stageImage) == VK_SUCCESS);
+    ASSERT(mVk.CreateImage(mDevice, &imageCreateInfo, nullptr, &outTexture->image) == VK_SUCCESS);
+    mResourceTracker->onCreate(ResourceTracker::Resource::kImage);
 
-    VkMemoryRequirements memoryRequirements;
-    mVk.GetImageMemoryRequirements(mDevice, stageImage, &memoryRequirements);
+    MemoryAllocator::Requirements requirements;
+    mMemoryAllocator.getRequirements(outTexture->image, VK_IMAGE_TILING_OPTIMAL, &requirements);
+    mMemoryAllocator.allocate(requirements, MemoryUsage::kGpuOnly, &outTexture->memory);
+    ASSERT(mVk.BindImageMemory(mDevice, outTexture->image, outTexture->memory.memory,
+                               outTexture->memory.offset) == VK_SUCCESS);
 
-    const uint32_t typeIndex = getMemoryTypeIndex(memoryRequirements.memoryTypeBits,
-                                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-    VkMemoryAllocateInfo memoryAllocateInfo = {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-            .pNext = nullptr,
-            .allocationSize = memoryRequirements.size,
-            .memoryTypeIndex = typeIndex,
-    };
-    ASSERT(mVk.AllocateMemory(mDevice, &memoryAllocateInfo, nullptr, &stageMemory) == VK_SUCCESS);
-    ASSERT(mVk.BindImageMemory(mDevice, stageImage, stageMemory, 0) == VK_SUCCESS);
+    // Transitions image out of UNDEFINED type. The host writes to the staging buffer are made
+    // visible by the submission itself.
+    setTextureLayout(batch->commandBuffer, outTexture->image, 0, levelCount,
+                     0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                     VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-    const VkImageSubresource imageSubresource = {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .mipLevel = 0,
-            .arrayLayer = 0,
-    };
-    VkSubresourceLayout subresourceLayout;
-    mVk.GetImageSubresourceLayout(mDevice, stageImage, &imageSubresource, &subresourceLayout);
+    mVk.CmdCopyBufferToImage(batch->commandBuffer, batch->stagingBuffer, outTexture->image,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copyCount, copyInfos.data());
 
-    void* textureData;
-    ASSERT(mVk.MapMemory(mDevice, stageMemory, 0, memoryAllocateInfo.allocationSize, 0,
-                         &textureData) == VK_SUCCESS);
+    // Record the image's original dimensions so we can respect it later
+    outTexture->format = image.format;
+    outTexture->levelCount = levelCount;
+    outTexture->width = imageWidth;
+    outTexture->height = imageHeight;
 
-    for (uint32_t row = 0, srcPos = 0, cols = 4 * imageWidth; row < imageHeight; row++) {
-        for (uint32_t col = 0; col < cols; col++) {
-            ((uint8_t*)textureData)[col] = imageData[srcPos++];
-        }
-        textureData = (uint8_t*)textureData + subresourceLayout.rowPitch;
-    }
-    ALOGD("RAW TEX:\n%X %X\n%X %X",
-          ((uint32_t *)imageData)[0],
-          ((uint32_t *)imageData)[imageWidth - 1],
-          ((uint32_t *)imageData)[imageWidth * (imageHeight - 1)],
-          ((uint32_t *)imageData)[imageWidth * (imageHeight - 1) + imageWidth - 1]);
-
-    mVk.UnmapMemory(mDevice, stageMemory);
-    stbi_image_free(imageData);
-    file.clear();
-
-    // Create a tile texture to blit into
-    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    ASSERT(mVk.CreateImage(mDevice, &imageCreateInfo, nullptr, &outTexture->image) == VK_SUCCESS);
+    // Frames submitted after the upload sample the image, and are ordered after this barrier
+    if (levelCount > copyCount) {
+        recordMipGeneration(batch->commandBuffer, *outTexture);
+    } else {
+        setTextureLayout(batch->commandBuffer, outTexture->image, 0, levelCount,
+                         VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    }
 
-    mVk.GetImageMemoryRequirements(mDevice, outTexture->image, &memoryRequirements);
+    createTextureView(outTexture);
+}
 
-    memoryAllocateInfo.allocationSize = memoryRequirements.size;
-    memoryAllocateInfo.memoryTypeIndex = getMemoryTypeIndex(memoryRequirements.memoryTypeBits,
-                                                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+void Renderer::recordMipGeneration(VkCommandBuffer commandBuffer, const Texture& texture) {
+    int32_t srcWidth = static_cast<int32_t>(texture.width);
+    int32_t srcHeight = static_cast<int32_t>(texture.height);
+    for (uint32_t level = 1; level < texture.levelCount; level++) {
+        // The level above was written by the copy or the previous blit
+        setTextureLayout(commandBuffer, texture.image, level - 1, 1,
+                         VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+        const int32_t dstWidth = std::max(srcWidth / 2, 1);
+        const int32_t dstHeight = std::max(srcHeight / 2, 1);
+        const VkImageBlit imageBlit = {
+                .srcSubresource =
+                        {
+                                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                .mipLevel = level - 1,
+                                .baseArrayLayer = 0,
+                                .layerCount = 1,
+                        },
+                .srcOffsets =
+                        {
+                                {.x = 0, .y = 0, .z = 0},
+                                {.x = srcWidth, .y = srcHeight, .z = 1},
+                        },
+                .dstSubresource =
+                        {
+                                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                                .mipLevel = level,
+                                .baseArrayLayer = 0,
+                                .layerCount = 1,
+                        },
+                .dstOffsets =
+                        {
+                                {.x = 0, .y = 0, .z = 0},
+                                {.x = dstWidth, .y = dstHeight, .z = 1},
+                        },
+        };
+        mVk.CmdBlitImage(commandBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit,
+                         VK_FILTER_LINEAR);
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
 
-    ASSERT(mVk.AllocateMemory(mDevice, &memoryAllocateInfo, nullptr, &outTexture->memory) ==
-           VK_SUCCESS);
-    ASSERT(mVk.BindImageMemory(mDevice, outTexture->image, outTexture->memory, 0) == VK_SUCCESS);
+    // Every level but the last was read by a blit
+    const uint32_t lastLevel = texture.levelCount - 1;
+    setTextureLayout(commandBuffer, texture.image, 0, lastLevel,
+                     VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    setTextureLayout(commandBuffer, texture.image, lastLevel, 1,
+                     VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
 
-    VkCommandPoolCreateInfo commandPoolCreateInfo = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+void Renderer::createTextureView(Texture* texture) {
+    const VkImageViewCreateInfo viewCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
             .pNext = nullptr,
-            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-            .queueFamilyIndex = mQueueFamilyIndex,
+            .flags = 0,
+            .image = texture->image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = texture->format,
+            .components =
+                    {
+                            VK_COMPONENT_SWIZZLE_R,
+                            VK_COMPONENT_SWIZZLE_G,
+                            VK_COMPONENT_SWIZZLE_B,
+                            VK_COMPONENT_SWIZZLE_A,
+                    },
+            .subresourceRange =
+                    {
+                            VK_IMAGE_ASPECT_COLOR_BIT,
+                            0,
+                            texture->levelCount,
+                            0,
+                            1,
+                    },
     };
-    VkCommandPool commandPool;
-    ASSERT(mVk.CreateCommandPool(mDevice, &commandPoolCreateInfo, nullptr, &commandPool) ==
-           VK_SUCCESS);
+    ASSERT(mVk.CreateImageView(mDevice, &viewCreateInfo, nullptr, &texture->view) == VK_SUCCESS);
+    mResourceTracker->onCreate(ResourceTracker::Resource::kImageView);
+}
+
+void Renderer::destroyTexture(Texture* texture) {
+    // Textures still streaming in have a sampler but no image yet
+    if (texture->image != VK_NULL_HANDLE) {
+        mVk.DestroyImageView(mDevice, texture->view, nullptr);
+        mResourceTracker->onDestroy(ResourceTracker::Resource::kImageView);
+        mVk.DestroyImage(mDevice, texture->image, nullptr);
+        mResourceTracker->onDestroy(ResourceTracker::Resource::kImage);
+        mMemoryAllocator.free(&texture->memory);
+    }
+    mVk.DestroySampler(mDevice, texture->sampler, nullptr);
+    *texture = Texture();
+}
 
-    VkCommandBuffer commandBuffer;
+void Renderer::beginUploadBatch(VkDeviceSize stagingSize, UploadBatch* outBatch) {
     const VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
             .pNext = nullptr,
-            .commandPool = commandPool,
+            .commandPool = mUploadCommandPool,
             .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
             .commandBufferCount = 1,
     };
+    ASSERT(mVk.AllocateCommandBuffers(mDevice, &commandBufferAllocateInfo,
+                                      &outBatch->commandBuffer) == VK_SUCCESS);
 
-    ASSERT(mVk.AllocateCommandBuffers(mDevice, &commandBufferAllocateInfo, &commandBuffer) ==
-           VK_SUCCESS);
-    VkCommandBufferBeginInfo commandBufferBeginInfo = {
+    const VkCommandBufferBeginInfo commandBufferBeginInfo = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
             .pNext = nullptr,
-            .flags = 0,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
             .pInheritanceInfo = nullptr,
     };
-    ASSERT(mVk.BeginCommandBuffer(commandBuffer, &commandBufferBeginInfo) == VK_SUCCESS);
+    ASSERT(mVk.BeginCommandBuffer(outBatch->commandBuffer, &commandBufferBeginInfo) ==
+           VK_SUCCESS);
+
+    if (stagingSize) {
+        createBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::kUpload,
+                     &outBatch->stagingBuffer, &outBatch->stagingMemory);
+    }
+}
+
+void Renderer::submitUploadBatch(UploadBatch* batch) {
+    ASSERT(mVk.EndCommandBuffer(batch->commandBuffer) == VK_SUCCESS);
+    if (batch->stagingBuffer != VK_NULL_HANDLE) {
+        mMemoryAllocator.flush(batch->stagingMemory);
+    }
+
+    // Nothing waits for the batch, its completion is only polled
+    if (!mUseTimeline) {
+        const VkFenceCreateInfo fenceCreateInfo = {
+                .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+        };
+        ASSERT(mVk.CreateFence(mDevice, &fenceCreateInfo, nullptr, &batch->fence) == VK_SUCCESS);
+    }
+    batch->serial = queueSubmit(batch->commandBuffer, VK_NULL_HANDLE, 0, VK_NULL_HANDLE,
+                                batch->fence, VK_NULL_HANDLE);
+    mUploadBatches.push_back(std::move(*batch));
+}
+
+bool Renderer::isUploadBatchComplete(const UploadBatch& batch) {
+    if (isSerialComplete(batch.serial)) {
+        return true;
+    }
+    if (batch.fence == VK_NULL_HANDLE || mVk.GetFenceStatus(mDevice, batch.fence) != VK_SUCCESS) {
+        return false;
+    }
+
+    // Submissions on the same queue signal in order
+    mCompletedSerial = batch.serial;
+    return true;
+}
 
-    setImageLayout(commandBuffer, stageImage,
-                   VK_ACCESS_HOST_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
-                   VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                   VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+void Renderer::destroyUploadBatch(UploadBatch* batch) {
+    mVk.FreeCommandBuffers(mDevice, mUploadCommandPool, 1, &batch->commandBuffer);
+    batch->commandBuffer = VK_NULL_HANDLE;
+    destroyBuffer(&batch->stagingBuffer, &batch->stagingMemory);
+    mVk.DestroyFence(mDevice, batch->fence, nullptr);
+    batch->fence = VK_NULL_HANDLE;
+}
 
-    // Transitions image out of UNDEFINED type
-    setImageLayout(commandBuffer, outTexture->image,
+void Renderer::createPlaceholderTexture() {
+    const VkImageCreateInfo imageCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .extent =
+                    {
+                            .width = 1,
+                            .height = 1,
+                            .depth = 1,
+                    },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount = 1,
+            .pQueueFamilyIndices = &mQueueFamilyIndex,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    ASSERT(mVk.CreateImage(mDevice, &imageCreateInfo, nullptr, &mPlaceholderTexture.image) ==
+           VK_SUCCESS);
+    mResourceTracker->onCreate(ResourceTracker::Resource::kImage);
+
+    MemoryAllocator::Requirements requirements;
+    mMemoryAllocator.getRequirements(mPlaceholderTexture.image, VK_IMAGE_TILING_OPTIMAL,
+                                     &requirements);
+    mMemoryAllocator.allocate(requirements, MemoryUsage::kGpuOnly, &mPlaceholderTexture.memory);
+    ASSERT(mVk.BindImageMemory(mDevice, mPlaceholderTexture.image,
+                               mPlaceholderTexture.memory.memory,
+                               mPlaceholderTexture.memory.offset) == VK_SUCCESS);
+    mPlaceholderTexture.format = VK_FORMAT_R8G8B8A8_UNORM;
+    mPlaceholderTexture.levelCount = 1;
+    createTextureView(&mPlaceholderTexture);
+    mPlaceholderTexture.width = 1;
+    mPlaceholderTexture.height = 1;
+    mPlaceholderTexture.isResident = true;
+
+    // A single texel needs no staging, it's cleared on the GPU
+    UploadBatch batch;
+    beginUploadBatch(0, &batch);
+    setImageLayout(batch.commandBuffer, mPlaceholderTexture.image,
                    0, VK_ACCESS_TRANSFER_WRITE_BIT,
                    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                   VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+                   VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-    const VkImageCopy blitInfo = {
-            .srcSubresource = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .mipLevel = 0,
-                    .baseArrayLayer = 0,
-                    .layerCount = 1,
-                    },
-            .srcOffset = {
-                    .x = 0,
-                    .y = 0,
-                    .z = 0,
-                    },
-            .dstSubresource = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .mipLevel = 0,
-                    .baseArrayLayer = 0,
-                    .layerCount = 1,
-                    },
-            .dstOffset = {
-                    .x = 0,
-                    .y = 0,
-                    .z = 0,
-                    },
-            .extent = {
-                    .width = imageWidth,
-                    .height = imageHeight,
-                    .depth = 1,
-                    },
+    VkClearColorValue clearColor;
+    std::copy(std::begin(kPlaceholderColor), std::end(kPlaceholderColor), clearColor.float32);
+    const VkImageSubresourceRange subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
     };
-    mVk.CmdCopyImage(commandBuffer, stageImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                     outTexture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitInfo);
+    mVk.CmdClearColorImage(batch.commandBuffer, mPlaceholderTexture.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1,
+                           &subresourceRange);
 
-    setImageLayout(commandBuffer, outTexture->image,
+    setImageLayout(batch.commandBuffer, mPlaceholderTexture.image,
                    VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
                    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    submitUploadBatch(&batch);
+}
 
-    ASSERT(mVk.EndCommandBuffer(commandBuffer) == VK_SUCCESS);
-
-    const VkFenceCreateInfo fenceCreateInfo = {
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-            .pNext = nullptr,
-            .flags = 0,
-    };
-    VkFence fence;
-    ASSERT(mVk.CreateFence(mDevice, &fenceCreateInfo, nullptr, &fence) == VK_SUCCESS);
+void Renderer::createTextures() {
+    VkFormatProperties formatProperties;
+    mVk.GetPhysicalDeviceFormatProperties(mGpu, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+    ASSERT(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+    mIsMipGenerationSupported = (formatProperties.optimalTilingFeatures &
+                                 kMipGenerationFeatures) == kMipGenerationFeatures;
+    ALOGD("Mip generation: %s", mIsMipGenerationSupported ? "blit" : "unsupported");
 
-    const VkSubmitInfo submitInfo = {
-            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    // Upload command buffers are recorded once and freed when their batch completes
+    const VkCommandPoolCreateInfo commandPoolCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
             .pNext = nullptr,
-            .waitSemaphoreCount = 0,
-            .pWaitSemaphores = nullptr,
-            .pWaitDstStageMask = nullptr,
-            .commandBufferCount = 1,
-            .pCommandBuffers = &commandBuffer,
-            .signalSemaphoreCount = 0,
-            .pSignalSemaphores = nullptr,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = mQueueFamilyIndex,
     };
-    ASSERT(mVk.QueueSubmit(mQueue, 1, &submitInfo, fence) == VK_SUCCESS);
-    ASSERT(mVk.WaitForFences(mDevice, 1, &fence, VK_TRUE, kTimeout30Sec) == VK_SUCCESS);
-    mVk.DestroyFence(mDevice, fence, nullptr);
-
-    mVk.FreeCommandBuffers(mDevice, commandPool, 1, &commandBuffer);
-    mVk.DestroyCommandPool(mDevice, commandPool, nullptr);
-    mVk.DestroyImage(mDevice, stageImage, nullptr);
-    mVk.FreeMemory(mDevice, stageMemory, nullptr);
-
-    // Record the image's original dimensions so we can respect it later
-    outTexture->width = imageWidth;
-    outTexture->height = imageHeight;
+    ASSERT(mVk.CreateCommandPool(mDevice, &commandPoolCreateInfo, nullptr,
+                                 &mUploadCommandPool) == VK_SUCCESS);
 
-    ALOGD("Successfully loaded texture from %s", filePath);
-}
+    createPlaceholderTexture();
 
-void Renderer::createTextures() {
     mTextures.resize(kTextureCount);
     for (uint32_t i = 0; i < kTextureCount; i++) {
-        loadTextureFromFile(kTextureFiles[i], &mTextures[i]);
-
         const VkSamplerCreateInfo samplerCreateInfo = {
                 .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
                 .pNext = nullptr,
                 .flags = 0,
+                // Minified draws blend between the mips, magnified draws keep the texels sharp
                 .magFilter = VK_FILTER_NEAREST,
-                .minFilter = VK_FILTER_NEAREST,
-                .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+                .minFilter = VK_FILTER_LINEAR,
+                .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
                 .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
                 .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
                 .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
@@ -831,41 +1436,80 @@ void Renderer::createTextures() {
                 .compareEnable = VK_FALSE,
                 .compareOp = VK_COMPARE_OP_NEVER,
                 .minLod = 0.0F,
-                .maxLod = 0.0F,
+                .maxLod = VK_LOD_CLAMP_NONE,
                 .borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
                 .unnormalizedCoordinates = VK_FALSE,
         };
         ASSERT(mVk.CreateSampler(mDevice, &samplerCreateInfo, nullptr, &mTextures[i].sampler) ==
                VK_SUCCESS);
+    }
 
-        const VkImageViewCreateInfo viewCreateInfo = {
-                .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-                .pNext = nullptr,
-                .flags = 0,
-                .image = mTextures[i].image,
-                .viewType = VK_IMAGE_VIEW_TYPE_2D,
-                .format = VK_FORMAT_R8G8B8A8_UNORM,
-                .components =
-                        {
-                                VK_COMPONENT_SWIZZLE_R,
-                                VK_COMPONENT_SWIZZLE_G,
-                                VK_COMPONENT_SWIZZLE_B,
-                                VK_COMPONENT_SWIZZLE_A,
-                        },
-                .subresourceRange =
-                        {
-                                VK_IMAGE_ASPECT_COLOR_BIT,
-                                0,
-                                1,
-                                0,
-                                1,
-                        },
-        };
-        ASSERT(mVk.CreateImageView(mDevice, &viewCreateInfo, nullptr, &mTextures[i].view) ==
-               VK_SUCCESS);
+    // Each texture may ship next to its PNG as KTX2 files in compressed formats. The first variant
+    // in a format the device samples is loaded, and the PNG is decoded on the CPU otherwise.
+    std::vector<std::vector<std::string>> filePaths(kTextureCount);
+    for (uint32_t i = 0; i < kTextureCount; i++) {
+        const std::string filePath = kTextureFiles[i];
+        const std::string stem = filePath.substr(0, filePath.rfind('.'));
+        for (const auto& compressedFormat : kCompressedFormats) {
+            if (isTextureFormatSupported(compressedFormat.format)) {
+                filePaths[i].push_back(stem + compressedFormat.extension);
+            }
+        }
+        filePaths[i].push_back(filePath);
+    }
+
+    // The files are read and decoded in the background, and the first frames draw the placeholder
+    mResidentTextureCount = 0;
+    mTextureLoader.start(filePaths, [this](const char* filePath) {
+        return readAsset(filePath, true);
+    });
+
+    mIsContentDirty = true;
+
+    ALOGD("Successfully created textures, %u streaming in", kTextureCount);
+}
+
+void Renderer::streamTextures() {
+    // Batches complete in submission order
+    while (!mUploadBatches.empty() && isUploadBatchComplete(mUploadBatches.front())) {
+        destroyUploadBatch(&mUploadBatches.front());
+        mUploadBatches.erase(mUploadBatches.begin());
+    }
+
+    std::vector<TextureLoader::Image> images;
+    mTextureLoader.takeImages(&images);
+    if (images.empty()) {
+        return;
+    }
+
+    // Everything decoded since the last frame goes into a single batch, so the cost of a batch
+    // grows with the bytes uploaded rather than the number of images
+    std::vector<VkDeviceSize> stagingOffsets(images.size());
+    VkDeviceSize stagingSize = 0;
+    for (size_t i = 0; i < images.size(); i++) {
+        stagingOffsets[i] = stagingSize;
+        stagingSize += getStagingSize(images[i]);
+    }
+
+    UploadBatch batch;
+    beginUploadBatch(stagingSize, &batch);
+    for (size_t i = 0; i < images.size(); i++) {
+        const TextureLoader::Image& image = images[i];
+        recordTextureUpload(&batch, stagingOffsets[i], image, &mTextures[image.index]);
+        // Frame verification expects the first texture on screen, as it was uploaded. The texels
+        // of a compressed format are only known to the GPU, so those frames aren't verified.
+        if (image.index == 0 && !image.isCompressed()) {
+            mFrameVerifier.setTexture(std::move(images[i]));
+        }
     }
+    submitUploadBatch(&batch);
 
-    ALOGD("Successfully created textures");
+    for (const auto& image : images) {
+        mTextures[image.index].isResident = true;
+        ALOGD("%s[%u] - %s is resident", __FUNCTION__, mFrameCount, kTextureFiles[image.index]);
+    }
+    mResidentTextureCount += static_cast<uint32_t>(images.size());
+    updateDescriptorSet();
 }
 
 void Renderer::createDescriptorSet() {
@@ -885,14 +1529,16 @@ void Renderer::createDescriptorSet() {
     ASSERT(mVk.CreateDescriptorSetLayout(mDevice, &descriptorSetLayoutCreateInfo, nullptr,
                                          &mDescriptorSetLayout) == VK_SUCCESS);
 
+    // Every upload batch makes at least one more texture resident
+    const uint32_t maxSets = kTextureCount + 1;
     const VkDescriptorPoolSize descriptorPoolSize = {
             .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            .descriptorCount = kTextureCount,
+            .descriptorCount = kTextureCount * maxSets,
     };
     const VkDescriptorPoolCreateInfo descriptor_pool = {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
             .pNext = nullptr,
-            .maxSets = 1,
+            .maxSets = maxSets,
             .poolSizeCount = 1,
             .pPoolSizes = &descriptorPoolSize,
     };
@@ -900,6 +1546,12 @@ void Renderer::createDescriptorSet() {
     ASSERT(mVk.CreateDescriptorPool(mDevice, &descriptor_pool, nullptr, &mDescriptorPool) ==
            VK_SUCCESS);
 
+    updateDescriptorSet();
+
+    ALOGD("Successfully created descriptor set");
+}
+
+void Renderer::updateDescriptorSet() {
     VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {
             .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
             .pNext = nullptr,
@@ -912,8 +1564,9 @@ void Renderer::createDescriptorSet() {
 
     VkDescriptorImageInfo descriptorImageInfo[kTextureCount];
     for (uint32_t i = 0; i < kTextureCount; i++) {
+        const Texture& texture = mTextures[i].isResident ? mTextures[i] : mPlaceholderTexture;
         descriptorImageInfo[i].sampler = mTextures[i].sampler;
-        descriptorImageInfo[i].imageView = mTextures[i].view;
+        descriptorImageInfo[i].imageView = texture.view;
         descriptorImageInfo[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     }
 
@@ -931,13 +1584,15 @@ void Renderer::createDescriptorSet() {
     };
     mVk.UpdateDescriptorSets(mDevice, 1, &writeDescriptorSet, 0, nullptr);
 
-    ALOGD("Successfully created descriptor set");
+    // Pre-recorded command buffers bind the previous set
+    mCommandGeneration++;
+    mIsContentDirty = true;
 }
 
 void Renderer::loadShaderFromFile(const char* filePath, VkShaderModule* outShader) {
     ASSERT(filePath);
 
-    std::vector<char> file = readFileFromAsset(mAssetManager, filePath, AASSET_MODE_BUFFER);
+    std::vector<char> file = readAsset(filePath);
 
     const VkShaderModuleCreateInfo shaderModuleCreateInfo = {
             .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
@@ -1174,52 +1829,112 @@ void Renderer::createGraphicsPipeline() {
     ALOGD("Successfully created graphics pipeline");
 }
 
-void Renderer::createVertexBuffer() {
-    const float vertexData[16] = {
-            -1.0F, -1.0F, 0.0F, 0.0F, // LT
-            -1.0F, 1.0F,  0.0F, 1.0F, // LB
-            1.0F,  -1.0F, 1.0F, 0.0F, // RT
-            1.0F,  1.0F,  1.0F, 1.0F, // RB
+void Renderer::createComputePipeline(const char* shaderFile, uint32_t pushConstantSize,
+                                     VkDescriptorSetLayout* outSetLayout,
+                                     VkPipelineLayout* outPipelineLayout, VkPipeline* outPipeline) {
+    // Binding 0 is the offscreen copy of the frame, binding 1 what the shader reduces it into
+    const VkDescriptorSetLayoutBinding descriptorSetLayoutBindings[2] = {
+            {
+                    .binding = 0,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .descriptorCount = 1,
+                    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .pImmutableSamplers = nullptr,
+            },
+            {
+                    .binding = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .descriptorCount = 1,
+                    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                    .pImmutableSamplers = nullptr,
+            },
+    };
+    const VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .pNext = nullptr,
+            .bindingCount = 2,
+            .pBindings = descriptorSetLayoutBindings,
     };
+    ASSERT(mVk.CreateDescriptorSetLayout(mDevice, &descriptorSetLayoutCreateInfo, nullptr,
+                                         outSetLayout) == VK_SUCCESS);
 
-    const uint32_t queueFamilyIndex = mQueueFamilyIndex;
-    const VkBufferCreateInfo bufferCreateInfo = {
-            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    const VkPushConstantRange pushConstantRange = {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = pushConstantSize,
+    };
+    const VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
             .pNext = nullptr,
             .flags = 0,
-            .size = sizeof(vertexData),
-            .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-            .queueFamilyIndexCount = 1,
-            .pQueueFamilyIndices = &queueFamilyIndex,
+            .setLayoutCount = 1,
+            .pSetLayouts = outSetLayout,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &pushConstantRange,
     };
-    ASSERT(mVk.CreateBuffer(mDevice, &bufferCreateInfo, nullptr, &mVertexBuffer) == VK_SUCCESS);
+    ASSERT(mVk.CreatePipelineLayout(mDevice, &pipelineLayoutCreateInfo, nullptr,
+                                    outPipelineLayout) == VK_SUCCESS);
 
-    VkMemoryRequirements memoryRequirements;
-    mVk.GetBufferMemoryRequirements(mDevice, mVertexBuffer, &memoryRequirements);
+    VkShaderModule computeShader = VK_NULL_HANDLE;
+    loadShaderFromFile(shaderFile, &computeShader);
 
-    uint32_t typeIndex = getMemoryTypeIndex(memoryRequirements.memoryTypeBits,
-                                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-    VkMemoryAllocateInfo memoryAllocateInfo = {
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    const VkComputePipelineCreateInfo pipelineCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
             .pNext = nullptr,
-            .allocationSize = memoryRequirements.size,
-            .memoryTypeIndex = typeIndex,
+            .flags = 0,
+            .stage =
+                    {
+                            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                            .pNext = nullptr,
+                            .flags = 0,
+                            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                            .module = computeShader,
+                            .pName = "main",
+                            .pSpecializationInfo = nullptr,
+                    },
+            .layout = *outPipelineLayout,
+            .basePipelineHandle = VK_NULL_HANDLE,
+            .basePipelineIndex = 0,
     };
-    ASSERT(mVk.AllocateMemory(mDevice, &memoryAllocateInfo, nullptr, &mVertexMemory) == VK_SUCCESS);
+    ASSERT(mVk.CreateComputePipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr,
+                                      outPipeline) == VK_SUCCESS);
+
+    mVk.DestroyShaderModule(mDevice, computeShader, nullptr);
+
+    ALOGD("Successfully created compute pipeline from %s", shaderFile);
+}
 
-    void* data;
-    ASSERT(mVk.MapMemory(mDevice, mVertexMemory, 0, sizeof(vertexData), 0, &data) == VK_SUCCESS);
+void Renderer::createComputePipelines() {
+    createComputePipeline(kChecksumShaderFile, sizeof(ChecksumPushConstantBlock),
+                          &mChecksumSetLayout, &mChecksumPipelineLayout, &mChecksumPipeline);
+    createComputePipeline(kYuvShaderFile, sizeof(YuvPushConstantBlock), &mYuvSetLayout,
+                          &mYuvPipelineLayout, &mYuvPipeline);
+}
+
+void Renderer::createVertexBuffer() {
+    const float vertexData[16] = {
+            -1.0F, -1.0F, 0.0F, 0.0F, // LT
+            -1.0F, 1.0F,  0.0F, 1.0F, // LB
+            1.0F,  -1.0F, 1.0F, 0.0F, // RT
+            1.0F,  1.0F,  1.0F, 1.0F, // RB
+    };
 
-    memcpy(data, vertexData, sizeof(vertexData));
-    mVk.UnmapMemory(mDevice, mVertexMemory);
+    // Written once here and only read by the GPU after that
+    createBuffer(sizeof(vertexData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, MemoryUsage::kUpload,
+                 &mVertexBuffer, &mVertexMemory);
+    memcpy(mVertexMemory.data, vertexData, sizeof(vertexData));
+    mMemoryAllocator.flush(mVertexMemory);
 
-    ASSERT(mVk.BindBufferMemory(mDevice, mVertexBuffer, mVertexMemory, 0) == VK_SUCCESS);
+    // The textured quad as a triangle strip
+    mDraws.push_back({
+            .vertexCount = 4,
+            .firstVertex = 0,
+    });
 
     ALOGD("Successfully created vertex buffer");
 }
 
-void Renderer::createCommandBuffers() {
+void Renderer::createCommandPool() {
     const VkCommandPoolCreateInfo commandPoolCreateInfo = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
             .pNext = nullptr,
@@ -1229,18 +1944,71 @@ void Renderer::createCommandBuffers() {
     ASSERT(mVk.CreateCommandPool(mDevice, &commandPoolCreateInfo, nullptr, &mCommandPool) ==
            VK_SUCCESS);
 
-    mCommandBuffers.resize(kInflight, VK_NULL_HANDLE);
-    const VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    // The render thread takes one of the recording jobs itself
+    const uint32_t coreCount = std::thread::hardware_concurrency();
+    const uint32_t workerCount = std::min(kMaxRecordingWorkers, coreCount > 1 ? coreCount - 1 : 0);
+    mRecordingWorkers = std::make_unique<WorkerPool>(workerCount);
+    mRecordingJobCount = workerCount + 1;
+
+    ALOGD("Successfully created command pool with %u recording jobs", mRecordingJobCount);
+}
+
+void Renderer::createRecordingPools(FrameContext* frame) {
+    const VkCommandPoolCreateInfo commandPoolCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
             .pNext = nullptr,
-            .commandPool = mCommandPool,
-            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandBufferCount = kInflight,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = mQueueFamilyIndex,
     };
-    ASSERT(mVk.AllocateCommandBuffers(mDevice, &commandBufferAllocateInfo,
-                                      mCommandBuffers.data()) == VK_SUCCESS);
+    frame->recordingPools.resize(mRecordingJobCount);
+    for (auto& commandPool : frame->recordingPools) {
+        ASSERT(mVk.CreateCommandPool(mDevice, &commandPoolCreateInfo, nullptr, &commandPool) ==
+               VK_SUCCESS);
+    }
+}
+
+void Renderer::createFrameContexts(uint32_t count) {
+    mFrames.resize(count);
+    for (auto& frame : mFrames) {
+        createRecordingPools(&frame);
+    }
+    createSemaphores();
+    createFences();
+    createQueryPools();
+    createFrameDescriptorSets();
+
+    ALOGD("Successfully created %u frame contexts", count);
+}
 
-    ALOGD("Successfully created command buffers");
+void Renderer::destroyFrameContexts() {
+    // Also frees the checksum and YUV descriptor sets of the frame contexts
+    mVk.DestroyDescriptorPool(mDevice, mFrameDescriptorPool, nullptr);
+    mFrameDescriptorPool = VK_NULL_HANDLE;
+
+    for (auto& frame : mFrames) {
+        // The device is idle, so a recorded frame is complete and can still go to the sink
+        readbackRecording(&frame);
+        destroyReadbackBuffer(&frame);
+        mVk.DestroyFence(mDevice, frame.inflightFence, nullptr);
+        mVk.DestroySemaphore(mDevice, frame.acquireSemaphore, nullptr);
+        mVk.DestroySemaphore(mDevice, frame.renderSemaphore, nullptr);
+        mVk.DestroyQueryPool(mDevice, frame.queryPool, nullptr);
+        for (auto& recordedCommands : frame.recordedCommands) {
+            if (recordedCommands.commandBuffer != VK_NULL_HANDLE) {
+                mVk.FreeCommandBuffers(mDevice, mCommandPool, 1, &recordedCommands.commandBuffer);
+            }
+        }
+        for (auto& recordedCommands : frame.recordingCommands) {
+            if (recordedCommands.commandBuffer != VK_NULL_HANDLE) {
+                mVk.FreeCommandBuffers(mDevice, mCommandPool, 1, &recordedCommands.commandBuffer);
+            }
+        }
+        // Also frees the secondary command buffers allocated from them
+        for (auto& commandPool : frame.recordingPools) {
+            mVk.DestroyCommandPool(mDevice, commandPool, nullptr);
+        }
+    }
+    mFrames.clear();
 }
 
 void Renderer::createSemaphore(VkSemaphore* outSemaphore) {
@@ -1253,95 +2021,756 @@ void Renderer::createSemaphore(VkSemaphore* outSemaphore) {
 }
 
 void Renderer::createSemaphores() {
-    mAcquireSemaphores.resize(kInflight, VK_NULL_HANDLE);
-    mRenderSemaphores.resize(kInflight, VK_NULL_HANDLE);
-    for (int i = 0; i < kInflight; i++) {
-        createSemaphore(&mAcquireSemaphores[i]);
-        createSemaphore(&mRenderSemaphores[i]);
+    for (auto& frame : mFrames) {
+        createSemaphore(&frame.acquireSemaphore);
+        createSemaphore(&frame.renderSemaphore);
     }
 
     ALOGD("Successfully created semaphores");
 }
 
 void Renderer::createFences() {
-    mInflightFences.resize(kInflight, VK_NULL_HANDLE);
+    // The timeline semaphore tracks frame completion on its own
+    if (mUseTimeline) {
+        return;
+    }
+
     const VkFenceCreateInfo fenceCreateInfo = {
             .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
             .pNext = nullptr,
             .flags = VK_FENCE_CREATE_SIGNALED_BIT,
     };
-    for (int i = 0; i < kInflight; i++) {
-        ASSERT(mVk.CreateFence(mDevice, &fenceCreateInfo, nullptr, &mInflightFences[i]) ==
+    for (auto& frame : mFrames) {
+        ASSERT(mVk.CreateFence(mDevice, &fenceCreateInfo, nullptr, &frame.inflightFence) ==
                VK_SUCCESS);
     }
 
     ALOGD("Successfully created fences");
 }
 
-void Renderer::createFramebuffer(uint32_t index) {
-    const VkImageViewCreateInfo imageViewCreateInfo = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+void Renderer::createQueryPools() {
+    if (!mHasTimestamps) {
+        return;
+    }
+
+    const VkQueryPoolCreateInfo queryPoolCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
             .pNext = nullptr,
             .flags = 0,
-            .image = mImages[index],
-            .viewType = VK_IMAGE_VIEW_TYPE_2D,
-            .format = mFormat,
-            .components =
-                    {
-                            .r = VK_COMPONENT_SWIZZLE_R,
-                            .g = VK_COMPONENT_SWIZZLE_G,
-                            .b = VK_COMPONENT_SWIZZLE_B,
-                            .a = VK_COMPONENT_SWIZZLE_A,
-                    },
-            .subresourceRange =
-                    {
-                            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                            .baseMipLevel = 0,
-                            .levelCount = 1,
-                            .baseArrayLayer = 0,
-                            .layerCount = 1,
-                    },
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = kTimestampCount,
+            .pipelineStatistics = 0,
     };
-    ASSERT(mVk.CreateImageView(mDevice, &imageViewCreateInfo, nullptr, &mImageViews[index]) ==
-           VK_SUCCESS);
+    for (auto& frame : mFrames) {
+        ASSERT(mVk.CreateQueryPool(mDevice, &queryPoolCreateInfo, nullptr, &frame.queryPool) ==
+               VK_SUCCESS);
+    }
 
-    const VkFramebufferCreateInfo framebufferCreateInfo = {
-            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+    ALOGD("Successfully created query pools");
+}
+
+void Renderer::createFrameDescriptorSets() {
+    // Checksum sets for the offscreen and the capture copy plus a YUV set per recording slot for
+    // every frame context, each with two storage buffers
+    const auto frameCount = static_cast<uint32_t>(mFrames.size());
+    const uint32_t setCount = frameCount * (2 + FrameRecorder::kSlotCount);
+    const VkDescriptorPoolSize descriptorPoolSize = {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = setCount * 2,
+    };
+    const VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
             .pNext = nullptr,
             .flags = 0,
-            .renderPass = mRenderPass,
-            .attachmentCount = 1,
-            .pAttachments = &mImageViews[index],
-            .width = mImageWidth,
-            .height = mImageHeight,
-            .layers = 1,
+            .maxSets = setCount,
+            .poolSizeCount = 1,
+            .pPoolSizes = &descriptorPoolSize,
     };
-    ASSERT(mVk.CreateFramebuffer(mDevice, &framebufferCreateInfo, nullptr, &mFramebuffers[index]) ==
-           VK_SUCCESS);
+    ASSERT(mVk.CreateDescriptorPool(mDevice, &descriptorPoolCreateInfo, nullptr,
+                                    &mFrameDescriptorPool) == VK_SUCCESS);
+
+    // The checksum sets are written once the readback and capture buffers of their frame
+    // contexts are created, the YUV sets whenever their recording commands are recorded
+    const VkDescriptorSetLayout checksumSetLayouts[2] = {mChecksumSetLayout, mChecksumSetLayout};
+    const std::vector<VkDescriptorSetLayout> yuvSetLayouts(FrameRecorder::kSlotCount,
+                                                           mYuvSetLayout);
+    for (auto& frame : mFrames) {
+        const VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .pNext = nullptr,
+                .descriptorPool = mFrameDescriptorPool,
+                .descriptorSetCount = 2,
+                .pSetLayouts = checksumSetLayouts,
+        };
+        VkDescriptorSet checksumDescriptorSets[2];
+        ASSERT(mVk.AllocateDescriptorSets(mDevice, &descriptorSetAllocateInfo,
+                                          checksumDescriptorSets) == VK_SUCCESS);
+        frame.checksumDescriptorSet = checksumDescriptorSets[0];
+        frame.captureChecksumDescriptorSet = checksumDescriptorSets[1];
+
+        frame.yuvDescriptorSets.resize(FrameRecorder::kSlotCount);
+        const VkDescriptorSetAllocateInfo yuvDescriptorSetAllocateInfo = {
+                .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+                .pNext = nullptr,
+                .descriptorPool = mFrameDescriptorPool,
+                .descriptorSetCount = FrameRecorder::kSlotCount,
+                .pSetLayouts = yuvSetLayouts.data(),
+        };
+        ASSERT(mVk.AllocateDescriptorSets(mDevice, &yuvDescriptorSetAllocateInfo,
+                                          frame.yuvDescriptorSets.data()) == VK_SUCCESS);
+    }
 
-    ALOGD("Successfully created framebuffer[%u]", index);
+    ALOGD("Successfully created frame descriptor sets");
 }
 
-void Renderer::recordCommandBuffer(uint32_t frameIndex, uint32_t imageIndex) {
-    const VkCommandBufferBeginInfo commandBufferBeginInfo = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+void Renderer::createTimelineSemaphore() {
+    if (!mUseTimeline) {
+        return;
+    }
+
+    const VkSemaphoreTypeCreateInfoKHR semaphoreTypeCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
             .pNext = nullptr,
-            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-            .pInheritanceInfo = nullptr,
+            .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+            .initialValue = 0,
     };
-    ASSERT(mVk.BeginCommandBuffer(mCommandBuffers[frameIndex], &commandBufferBeginInfo) ==
-           VK_SUCCESS);
+    const VkSemaphoreCreateInfo semaphoreCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = &semaphoreTypeCreateInfo,
+            .flags = 0,
+    };
+    ASSERT(mVk.CreateSemaphore(mDevice, &semaphoreCreateInfo, nullptr, &mTimeline) == VK_SUCCESS);
 
-    setImageLayout(mCommandBuffers[frameIndex], mImages[imageIndex],
-                   0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-                   VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
-                   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                   VK_QUEUE_FAMILY_FOREIGN_EXT, mQueueFamilyIndex);
+    ALOGD("Successfully created timeline semaphore");
+}
 
-    const VkClearValue clearVals = {
-            .color = {
-                    .float32 = { 0.5F, 0.5F, 0.5F, 1.0F },
-                    },
+uint64_t Renderer::queueSubmit(VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore,
+                               VkPipelineStageFlags waitStageMask, VkSemaphore signalSemaphore,
+                               VkFence fence, VkCommandBuffer trailingCommandBuffer) {
+    const uint64_t serial = ++mSubmitSerial;
+
+    // Binary semaphores ignore their values, the timeline one is signaled with the serial
+    const uint64_t waitValue = 0;
+    VkSemaphore signalSemaphores[2];
+    uint64_t signalValues[2];
+    uint32_t signalCount = 0;
+    if (signalSemaphore != VK_NULL_HANDLE) {
+        signalSemaphores[signalCount] = signalSemaphore;
+        signalValues[signalCount++] = 0;
+    }
+    const uint32_t binarySignalCount = signalCount;
+    if (mUseTimeline) {
+        signalSemaphores[signalCount] = mTimeline;
+        signalValues[signalCount++] = serial;
+    }
+
+    // The trailing command buffer gets a batch of its own, which signals the timeline instead of
+    // the first one. A semaphore signal also waits for every batch submitted before it, so the
+    // serial still covers both.
+    const uint32_t batchCount = trailingCommandBuffer != VK_NULL_HANDLE ? 2 : 1;
+    const uint32_t firstSignalCount = batchCount == 2 ? binarySignalCount : signalCount;
+    const uint32_t waitCount = waitSemaphore != VK_NULL_HANDLE ? 1 : 0;
+    const VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfos[2] = {
+            {
+                    .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+                    .pNext = nullptr,
+                    .waitSemaphoreValueCount = waitCount,
+                    .pWaitSemaphoreValues = &waitValue,
+                    .signalSemaphoreValueCount = firstSignalCount,
+                    .pSignalSemaphoreValues = signalValues,
+            },
+            {
+                    .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+                    .pNext = nullptr,
+                    .waitSemaphoreValueCount = 0,
+                    .pWaitSemaphoreValues = nullptr,
+                    .signalSemaphoreValueCount = signalCount - firstSignalCount,
+                    .pSignalSemaphoreValues = signalValues + firstSignalCount,
+            },
+    };
+    const VkSubmitInfo submitInfos[2] = {
+            {
+                    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                    .pNext = mUseTimeline ? &timelineSubmitInfos[0] : nullptr,
+                    .waitSemaphoreCount = waitCount,
+                    .pWaitSemaphores = &waitSemaphore,
+                    .pWaitDstStageMask = &waitStageMask,
+                    .commandBufferCount = 1,
+                    .pCommandBuffers = &commandBuffer,
+                    .signalSemaphoreCount = firstSignalCount,
+                    .pSignalSemaphores = signalSemaphores,
+            },
+            {
+                    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                    .pNext = mUseTimeline ? &timelineSubmitInfos[1] : nullptr,
+                    .waitSemaphoreCount = 0,
+                    .pWaitSemaphores = nullptr,
+                    .pWaitDstStageMask = nullptr,
+                    .commandBufferCount = 1,
+                    .pCommandBuffers = &trailingCommandBuffer,
+                    .signalSemaphoreCount = signalCount - firstSignalCount,
+                    .pSignalSemaphores = signalSemaphores + firstSignalCount,
+            },
+    };
+    // The fence signals once every batch has completed
+    ASSERT(mVk.QueueSubmit(mQueue, batchCount, submitInfos,
+                           mUseTimeline ? VK_NULL_HANDLE : fence) == VK_SUCCESS);
+
+    return serial;
+}
+
+void Renderer::waitForSerial(uint64_t serial) {
+    if (serial <= mCompletedSerial) {
+        return;
+    }
+
+    if (mUseTimeline) {
+        const VkSemaphoreWaitInfoKHR semaphoreWaitInfo = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+                .pNext = nullptr,
+                .flags = 0,
+                .semaphoreCount = 1,
+                .pSemaphores = &mTimeline,
+                .pValues = &serial,
+        };
+        ASSERT(mVk.WaitSemaphoresKHR(mDevice, &semaphoreWaitInfo, kTimeout30Sec) == VK_SUCCESS);
+    } else {
+        // A frame context is only reused after its serial has been waited, so a pending serial
+        // always belongs to one of them
+        auto frame = std::find_if(mFrames.begin(), mFrames.end(),
+                                  [serial](const FrameContext& f) { return f.serial == serial; });
+        ASSERT(frame != mFrames.end());
+        ASSERT(mVk.WaitForFences(mDevice, 1, &frame->inflightFence, VK_TRUE, kTimeout30Sec) ==
+               VK_SUCCESS);
+    }
+
+    // Submissions on the same queue signal in order
+    mCompletedSerial = serial;
+}
+
+bool Renderer::isSerialComplete(uint64_t serial) {
+    if (serial > mCompletedSerial && mUseTimeline) {
+        ASSERT(mVk.GetSemaphoreCounterValueKHR(mDevice, mTimeline, &mCompletedSerial) ==
+               VK_SUCCESS);
+    }
+    return serial <= mCompletedSerial;
+}
+
+void Renderer::createFramebuffer(uint32_t index) {
+    const VkImageViewCreateInfo imageViewCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .image = mImages[index],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = mFormat,
+            .components =
+                    {
+                            .r = VK_COMPONENT_SWIZZLE_R,
+                            .g = VK_COMPONENT_SWIZZLE_G,
+                            .b = VK_COMPONENT_SWIZZLE_B,
+                            .a = VK_COMPONENT_SWIZZLE_A,
+                    },
+            .subresourceRange =
+                    {
+                            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                            .baseMipLevel = 0,
+                            .levelCount = 1,
+                            .baseArrayLayer = 0,
+                            .layerCount = 1,
+                    },
+    };
+    ASSERT(mVk.CreateImageView(mDevice, &imageViewCreateInfo, nullptr, &mImageViews[index]) ==
+           VK_SUCCESS);
+    mResourceTracker->onCreate(ResourceTracker::Resource::kImageView);
+
+    const VkFramebufferCreateInfo framebufferCreateInfo = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .renderPass = mRenderPass,
+            .attachmentCount = 1,
+            .pAttachments = &mImageViews[index],
+            .width = mImageWidth,
+            .height = mImageHeight,
+            .layers = 1,
+    };
+    ASSERT(mVk.CreateFramebuffer(mDevice, &framebufferCreateInfo, nullptr, &mFramebuffers[index]) ==
+           VK_SUCCESS);
+    mResourceTracker->onCreate(ResourceTracker::Resource::kFramebuffer);
+
+    ALOGD("Successfully created framebuffer[%u]", index);
+}
+
+void Renderer::createReadbackBuffer(FrameContext* frame) {
+    // Every swapchain format used here has 4 bytes per pixel
+    createBuffer(VkDeviceSize(mImageWidth) * mImageHeight * 4,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 MemoryUsage::kGpuOnly, &frame->copyBuffer, &frame->copyMemory);
+
+    createBuffer(sizeof(ChecksumBlock),
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 MemoryUsage::kReadback, &frame->readbackBuffer, &frame->readbackMemory);
+
+    const VkDescriptorBufferInfo descriptorBufferInfos[2] = {
+            {
+                    .buffer = frame->copyBuffer,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+            },
+            {
+                    .buffer = frame->readbackBuffer,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+            },
+    };
+    const VkWriteDescriptorSet writeDescriptorSet = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext = nullptr,
+            .dstSet = frame->checksumDescriptorSet,
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 2,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pImageInfo = nullptr,
+            .pBufferInfo = descriptorBufferInfos,
+            .pTexelBufferView = nullptr,
+    };
+    mVk.UpdateDescriptorSets(mDevice, 1, &writeDescriptorSet, 0, nullptr);
+
+    // Updating the set invalidates every command buffer it's bound in, and the new buffers may
+    // reuse the handles of the old ones, so the command keys alone can't tell
+    mCommandGeneration++;
+
+    frame->copyWidth = mImageWidth;
+    frame->copyHeight = mImageHeight;
+
+    ALOGD("Successfully created readback buffer for %ux%u", mImageWidth, mImageHeight);
+}
+
+void Renderer::destroyReadbackBuffer(FrameContext* frame) {
+    destroyBuffer(&frame->copyBuffer, &frame->copyMemory);
+    frame->copyWidth = 0;
+    frame->copyHeight = 0;
+    destroyBuffer(&frame->readbackBuffer, &frame->readbackMemory);
+    destroyBuffer(&frame->captureBuffer, &frame->captureMemory);
+    frame->readback = Readback::kNone;
+}
+
+bool Renderer::createCaptureBuffer(FrameContext* frame) {
+    // Follows the offscreen copy, so it's replaced along with it. A captured frame is only copied
+    // once, so the checksum and the YUV conversion read it from here.
+    if (!createBuffer(VkDeviceSize(frame->copyWidth) * frame->copyHeight * 4,
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      MemoryUsage::kReadback, &frame->captureBuffer, &frame->captureMemory,
+                      true)) {
+        return false;
+    }
+
+    const VkDescriptorBufferInfo descriptorBufferInfos[2] = {
+            {
+                    .buffer = frame->captureBuffer,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+            },
+            {
+                    .buffer = frame->readbackBuffer,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+            },
+    };
+    const VkWriteDescriptorSet writeDescriptorSet = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext = nullptr,
+            .dstSet = frame->captureChecksumDescriptorSet,
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 2,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pImageInfo = nullptr,
+            .pBufferInfo = descriptorBufferInfos,
+            .pTexelBufferView = nullptr,
+    };
+    mVk.UpdateDescriptorSets(mDevice, 1, &writeDescriptorSet, 0, nullptr);
+    mCommandGeneration++;
+
+    ALOGD("Successfully created capture buffer for %ux%u", frame->copyWidth, frame->copyHeight);
+    return true;
+}
+
+void Renderer::readbackFrame(FrameContext* frame) {
+    const Readback readback = frame->readback;
+    frame->readback = Readback::kNone;
+
+    if (readback == Readback::kCapture || readback == Readback::kVerify) {
+        mMemoryAllocator.invalidate(frame->captureMemory);
+        if (frame->isVerified) {
+            verifyFrame(frame, frame->captureMemory.data);
+        }
+        if (frame->isScreenshot) {
+            captureFrame(frame, frame->captureMemory.data);
+        }
+    }
+
+    // The copy of a frame that was only recorded or verified has no checksum
+    if (readback != Readback::kChecksum && readback != Readback::kCapture) {
+        return;
+    }
+
+    mMemoryAllocator.invalidate(frame->readbackMemory);
+    const ChecksumBlock checksum = *static_cast<const ChecksumBlock*>(frame->readbackMemory.data);
+
+    // Mean luma from the bin centers, plus the fullest bin
+    const uint32_t binCount = sizeof(checksum.histogram) / sizeof(checksum.histogram[0]);
+    const uint32_t levelsPerBin = 256 / binCount;
+    uint64_t pixelCount = 0;
+    uint64_t lumaSum = 0;
+    uint32_t peakBin = 0;
+    for (uint32_t i = 0; i < binCount; i++) {
+        pixelCount += checksum.histogram[i];
+        lumaSum += uint64_t(checksum.histogram[i]) * (i * levelsPerBin + levelsPerBin / 2);
+        if (checksum.histogram[i] > checksum.histogram[peakBin]) {
+            peakBin = i;
+        }
+    }
+
+    const uint32_t* samples = checksum.samples;
+    ALOGD("READ BACK[%u]: hash[%08X] luma mean[%u] peak[%u-%u]\n%X %X\n%X %X\n%X %X\n%X %X",
+          frame->frameNumber, checksum.hash,
+          pixelCount ? static_cast<uint32_t>(lumaSum / pixelCount) : 0,
+          peakBin * levelsPerBin, (peakBin + 1) * levelsPerBin - 1,
+          samples[0], samples[1],
+          samples[2], samples[3],
+          samples[4], samples[5],
+          samples[6], samples[7]);
+}
+
+void Renderer::captureFrame(FrameContext* frame, const void* pixels) {
+    // Only the copy out of the mapped buffer happens here, un-rotating, encoding and writing the
+    // file are left to the screenshot writer
+    ScreenshotWriter::Capture capture;
+    capture.width = frame->copyWidth;
+    capture.height = frame->copyHeight;
+    capture.preTransform = frame->capturePreTransform;
+    capture.isBgra = mFormat == VK_FORMAT_B8G8R8A8_UNORM || mFormat == VK_FORMAT_B8G8R8A8_SRGB;
+    capture.frameNumber = frame->frameNumber;
+    capture.pixels.resize(size_t(capture.width) * capture.height * 4);
+    memcpy(capture.pixels.data(), pixels, capture.pixels.size());
+
+    if (!mScreenshotWriter->submit(&capture)) {
+        ALOGD("%s[%u] - screenshot writer busy, dropped capture", __FUNCTION__,
+              frame->frameNumber);
+    }
+}
+
+void Renderer::verifyFrame(FrameContext* frame, const void* pixels) {
+    // The copy follows the swapchain image, so the upright size is swapped for quarter turns
+    const bool isQuarterTurn = getQuarterTurns(frame->capturePreTransform) % 2 != 0;
+    mFrameVerifier.setTarget(isQuarterTurn ? frame->copyHeight : frame->copyWidth,
+                             isQuarterTurn ? frame->copyWidth : frame->copyHeight,
+                             frame->capturePreTransform,
+                             mFormat == VK_FORMAT_B8G8R8A8_UNORM ||
+                                     mFormat == VK_FORMAT_B8G8R8A8_SRGB,
+                             mFormat == VK_FORMAT_B8G8R8A8_SRGB ||
+                                     mFormat == VK_FORMAT_R8G8B8A8_SRGB);
+    const FrameVerifier::Result result =
+            mFrameVerifier.verify(static_cast<const uint8_t*>(pixels));
+
+    mVerificationStats.verifiedFrameCount++;
+    if (result.mismatchCount) {
+        mVerificationStats.mismatchedFrameCount++;
+        ALOGD("VERIFY[%u]: transform[%d] %u pixels mismatched in [%u, %u] - [%u, %u]",
+              frame->frameNumber, frame->capturePreTransform, result.mismatchCount, result.left,
+              result.top, result.right, result.bottom);
+    }
+    if (mVerificationStats.verifiedFrameCount % kLogInterval == 0) {
+        ALOGD("VERIFY: %u of %u frames mismatched", mVerificationStats.mismatchedFrameCount,
+              mVerificationStats.verifiedFrameCount);
+    }
+}
+
+bool Renderer::prepareRecordingSlot(uint32_t slot) {
+    if (mRecordingSlots.empty()) {
+        mRecordingSlots.resize(FrameRecorder::kSlotCount);
+    }
+    RecordingSlot& recordingSlot = mRecordingSlots[slot];
+
+    // Recorded upright, and cropped to whole blocks of the conversion
+    const bool isQuarterTurn = getQuarterTurns(mPreTransform) % 2 != 0;
+    const uint32_t width = isQuarterTurn ? mImageHeight : mImageWidth;
+    const uint32_t height = isQuarterTurn ? mImageWidth : mImageHeight;
+    recordingSlot.width = width / kYuvBlockWidth * kYuvBlockWidth;
+    recordingSlot.height = height / kYuvBlockHeight * kYuvBlockHeight;
+    recordingSlot.frameNumber = mFrameCount;
+
+    // The slot is free, so neither the GPU nor the sink is using it anymore. It only grows, since
+    // a smaller frame still fits.
+    const VkDeviceSize size = VkDeviceSize(recordingSlot.width) * recordingSlot.height * 3 / 2;
+    if (size <= recordingSlot.size) {
+        return true;
+    }
+
+    destroyBuffer(&recordingSlot.buffer, &recordingSlot.memory);
+    recordingSlot.size = 0;
+
+    // The new buffer may reuse the handle of the old one, so the command keys alone can't tell
+    mCommandGeneration++;
+
+    // The sink reads the converted frame in place, so it's the host reading it back
+    if (!createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MemoryUsage::kReadback,
+                      &recordingSlot.buffer, &recordingSlot.memory, true)) {
+        return false;
+    }
+    recordingSlot.size = size;
+
+    ALOGD("Successfully created recording slot[%u] for %ux%u", slot, recordingSlot.width,
+          recordingSlot.height);
+    return true;
+}
+
+void Renderer::destroyRecordingSlots() {
+    for (auto& recordingSlot : mRecordingSlots) {
+        destroyBuffer(&recordingSlot.buffer, &recordingSlot.memory);
+    }
+    mRecordingSlots.clear();
+}
+
+void Renderer::readbackRecording(FrameContext* frame) {
+    if (frame->recordingSlot < 0) {
+        return;
+    }
+    const auto slot = static_cast<uint32_t>(frame->recordingSlot);
+    frame->recordingSlot = -1;
+
+    // Nothing is copied here, the sink reads the slot in place and frees it once done
+    const RecordingSlot& recordingSlot = mRecordingSlots[slot];
+    mMemoryAllocator.invalidate(recordingSlot.memory);
+    const RecordedFrame recordedFrame = {
+            .data = static_cast<const uint8_t*>(recordingSlot.memory.data),
+            .size = size_t(recordingSlot.width) * recordingSlot.height * 3 / 2,
+            .width = recordingSlot.width,
+            .height = recordingSlot.height,
+            .format = mYuvFormat,
+            .frameNumber = recordingSlot.frameNumber,
+    };
+    mFrameRecorder->submit(slot, recordedFrame);
+}
+
+void Renderer::readTimestamps(FrameContext* frame) {
+    if (!frame->hasTimestamps) {
+        return;
+    }
+    frame->hasTimestamps = false;
+
+    // The submission has completed, so the results are available without waiting. The copy is
+    // only timed if the frame read back.
+    uint64_t timestamps[kTimestampCount];
+    const bool hasReadback = frame->readback != Readback::kNone;
+    const uint32_t queryCount = hasReadback ? kTimestampCount : kTimestampCopyBegin;
+    if (mVk.GetQueryPoolResults(mDevice, frame->queryPool, 0, queryCount,
+                                queryCount * sizeof(uint64_t), timestamps, sizeof(uint64_t),
+                                VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return;
+    }
+
+    auto getElapsedNanos = [&](uint32_t begin, uint32_t end) {
+        const uint64_t ticks = (timestamps[end] - timestamps[begin]) & mTimestampMask;
+        return static_cast<int64_t>(ticks * static_cast<double>(mTimestampPeriod));
+    };
+    mProfiler->addSample(FrameProfiler::Stage::kGpuRenderPass,
+                         getElapsedNanos(kTimestampRenderPassBegin, kTimestampRenderPassEnd));
+    if (hasReadback) {
+        mProfiler->addSample(FrameProfiler::Stage::kGpuReadbackCopy,
+                             getElapsedNanos(kTimestampCopyBegin, kTimestampCopyEnd));
+    }
+}
+
+Renderer::Readback Renderer::getReadback() {
+    // A screenshot also reads back the checksum, so it satisfies a pending readback request too
+    bool hasChecksum = mIsReadbackRequested || mIsScreenshotRequested;
+    // Frames drawn with the placeholder can't match the expected image
+    const bool hasCapture =
+            mIsScreenshotRequested || (mIsVerifyingFrames && isFrameVerifiable());
+    mIsReadbackRequested = false;
+    mIsScreenshotRequested = false;
+
+    switch (mReadbackPolicy) {
+        case ReadbackPolicy::kEveryNFrames:
+            hasChecksum |= (mFrameCount + 1) % mReadbackInterval == 0;
+            break;
+        case ReadbackPolicy::kOnTransformChange:
+            hasChecksum |= mSwapchainFrameCount < mImages.size();
+            break;
+        case ReadbackPolicy::kNever:
+        case ReadbackPolicy::kOnRequest:
+        default:
+            break;
+    }
+
+    if (hasCapture) {
+        return hasChecksum ? Readback::kCapture : Readback::kVerify;
+    }
+    return hasChecksum ? Readback::kChecksum : Readback::kNone;
+}
+
+VkCommandBuffer Renderer::getCommandBuffer(FrameContext* frame, uint32_t imageIndex,
+                                           Readback readback) {
+    const auto readbackCount = static_cast<uint32_t>(Readback::kCount);
+    const uint32_t index = imageIndex * readbackCount + static_cast<uint32_t>(readback);
+    if (index >= frame->recordedCommands.size()) {
+        frame->recordedCommands.resize(mImages.size() * readbackCount);
+    }
+    RecordedCommands& recordedCommands = frame->recordedCommands[index];
+
+    CommandKey key;
+    key.image = mImages[imageIndex];
+    key.readbackBuffer = readback != Readback::kNone ? frame->readbackBuffer : VK_NULL_HANDLE;
+    key.captureBuffer = readback == Readback::kCapture || readback == Readback::kVerify
+            ? frame->captureBuffer
+            : VK_NULL_HANDLE;
+    key.preTransform = mPreTransform;
+    key.width = mImageWidth;
+    key.height = mImageHeight;
+    key.generation = mCommandGeneration;
+    if (recordedCommands.isRecorded && recordedCommands.key == key) {
+        return recordedCommands.commandBuffer;
+    }
+
+    if (recordedCommands.commandBuffer == VK_NULL_HANDLE) {
+        const VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .pNext = nullptr,
+                .commandPool = mCommandPool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = 1,
+        };
+        ASSERT(mVk.AllocateCommandBuffers(mDevice, &commandBufferAllocateInfo,
+                                          &recordedCommands.commandBuffer) == VK_SUCCESS);
+    }
+
+    std::vector<VkCommandBuffer>& secondaryCommandBuffers =
+            recordedCommands.secondaryCommandBuffers;
+    if (secondaryCommandBuffers.empty()) {
+        secondaryCommandBuffers.resize(mRecordingJobCount);
+        for (uint32_t i = 0; i < mRecordingJobCount; i++) {
+            const VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
+                    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                    .pNext = nullptr,
+                    .commandPool = frame->recordingPools[i],
+                    .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                    .commandBufferCount = 1,
+            };
+            ASSERT(mVk.AllocateCommandBuffers(mDevice, &commandBufferAllocateInfo,
+                                              &secondaryCommandBuffers[i]) == VK_SUCCESS);
+        }
+    }
+
+    // The frame context has been waited, so none of its command buffers are pending anymore
+    recordCommandBuffer(recordedCommands.commandBuffer, frame, imageIndex, readback,
+                        secondaryCommandBuffers);
+    recordedCommands.key = key;
+    recordedCommands.isRecorded = true;
+
+    ALOGD("%s[%u] - recorded command buffer for image %u, readback %d", __FUNCTION__, mFrameCount,
+          imageIndex, static_cast<int>(readback));
+    return recordedCommands.commandBuffer;
+}
+
+VkCommandBuffer Renderer::getRecordingCommandBuffer(FrameContext* frame, uint32_t slot,
+                                                    Readback readback) {
+    if (frame->recordingCommands.empty()) {
+        frame->recordingCommands.resize(FrameRecorder::kSlotCount);
+    }
+    RecordedCommands& recordedCommands = frame->recordingCommands[slot];
+
+    // The offscreen copy and the YUV format are covered by the generation. A captured frame is
+    // converted from the capture buffer, so switching between the two records again.
+    const VkBuffer copyBuffer = getCopyBuffer(frame, readback);
+    CommandKey key;
+    key.readbackBuffer = mRecordingSlots[slot].buffer;
+    key.captureBuffer = copyBuffer == frame->captureBuffer ? copyBuffer : VK_NULL_HANDLE;
+    key.preTransform = mPreTransform;
+    key.width = mImageWidth;
+    key.height = mImageHeight;
+    key.generation = mCommandGeneration;
+    if (recordedCommands.isRecorded && recordedCommands.key == key) {
+        return recordedCommands.commandBuffer;
+    }
+
+    if (recordedCommands.commandBuffer == VK_NULL_HANDLE) {
+        const VkCommandBufferAllocateInfo commandBufferAllocateInfo = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .pNext = nullptr,
+                .commandPool = mCommandPool,
+                .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                .commandBufferCount = 1,
+        };
+        ASSERT(mVk.AllocateCommandBuffers(mDevice, &commandBufferAllocateInfo,
+                                          &recordedCommands.commandBuffer) == VK_SUCCESS);
+    }
+
+    // The frame context has been waited, so the set isn't bound by a pending command buffer
+    const VkDescriptorBufferInfo descriptorBufferInfos[2] = {
+            {
+                    .buffer = copyBuffer,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+            },
+            {
+                    .buffer = mRecordingSlots[slot].buffer,
+                    .offset = 0,
+                    .range = VK_WHOLE_SIZE,
+            },
+    };
+    const VkWriteDescriptorSet writeDescriptorSet = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .pNext = nullptr,
+            .dstSet = frame->yuvDescriptorSets[slot],
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorCount = 2,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pImageInfo = nullptr,
+            .pBufferInfo = descriptorBufferInfos,
+            .pTexelBufferView = nullptr,
+    };
+    mVk.UpdateDescriptorSets(mDevice, 1, &writeDescriptorSet, 0, nullptr);
+
+    recordYuvConversion(recordedCommands.commandBuffer, frame, slot, copyBuffer);
+    recordedCommands.key = key;
+    recordedCommands.isRecorded = true;
+
+    ALOGD("%s[%u] - recorded YUV conversion for slot %u", __FUNCTION__, mFrameCount, slot);
+    return recordedCommands.commandBuffer;
+}
+
+void Renderer::recordCommandBuffer(VkCommandBuffer commandBuffer, FrameContext* frame,
+                                   uint32_t imageIndex, Readback readback,
+                                   const std::vector<VkCommandBuffer>& secondaryCommandBuffers) {
+    // Not one-time submit, since the commands are replayed on later frames
+    const VkCommandBufferBeginInfo commandBufferBeginInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .pInheritanceInfo = nullptr,
+    };
+    ASSERT(mVk.BeginCommandBuffer(commandBuffer, &commandBufferBeginInfo) == VK_SUCCESS);
+
+    // Reset on every replay, before the queries are written again
+    if (mHasTimestamps) {
+        mVk.CmdResetQueryPool(commandBuffer, frame->queryPool, 0, kTimestampCount);
+    }
+
+    setImageLayout(commandBuffer, mImages[imageIndex],
+                   0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                   VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                   mExternalQueueFamilyIndex, mQueueFamilyIndex);
+
+    const VkClearValue clearVals = {
+            .color = {
+                    .float32 = { 0.5F, 0.5F, 0.5F, 1.0F },
+                    },
     };
     const VkRenderPassBeginInfo renderPassBeginInfo = {
             .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
@@ -1364,8 +2793,281 @@ void Renderer::recordCommandBuffer(uint32_t frameIndex, uint32_t imageIndex) {
             .clearValueCount = 1,
             .pClearValues = &clearVals,
     };
-    mVk.CmdBeginRenderPass(mCommandBuffers[frameIndex], &renderPassBeginInfo,
-                           VK_SUBPASS_CONTENTS_INLINE);
+    // Written once the acquire semaphore wait is satisfied, so presentation isn't counted
+    if (mHasTimestamps) {
+        mVk.CmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                              frame->queryPool, kTimestampRenderPassBegin);
+    }
+
+    mVk.CmdBeginRenderPass(commandBuffer, &renderPassBeginInfo,
+                           VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+    // Split the draws evenly across the jobs, job i records into its own secondary command buffer
+    // from its own pool, so the jobs need no locking
+    const uint32_t drawCount = static_cast<uint32_t>(mDraws.size());
+    const uint32_t jobCount = std::min(drawCount, mRecordingJobCount);
+    mRecordingWorkers->parallelFor(jobCount, [&](uint32_t job) {
+        const uint32_t firstDraw = drawCount * job / jobCount;
+        const uint32_t lastDraw = drawCount * (job + 1) / jobCount;
+        recordDraws(secondaryCommandBuffers[job], imageIndex, firstDraw, lastDraw - firstDraw);
+    });
+    mVk.CmdExecuteCommands(commandBuffer, jobCount, secondaryCommandBuffers.data());
+
+    mVk.CmdEndRenderPass(commandBuffer);
+
+    if (mHasTimestamps) {
+        mVk.CmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                              frame->queryPool, kTimestampRenderPassEnd);
+    }
+
+    if (readback != Readback::kNone) {
+        recordReadback(commandBuffer, frame, imageIndex, readback);
+    } else {
+        setImageLayout(commandBuffer, mImages[imageIndex],
+                       VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0,
+                       VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    }
+
+    setImageLayout(commandBuffer, mImages[imageIndex],
+                   0, 0,
+                   VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_GENERAL,
+                   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                   mQueueFamilyIndex, mExternalQueueFamilyIndex);
+
+    ASSERT(mVk.EndCommandBuffer(commandBuffer) == VK_SUCCESS);
+}
+
+void Renderer::recordReadback(VkCommandBuffer commandBuffer, FrameContext* frame,
+                              uint32_t imageIndex, Readback readback) {
+    setImageLayout(commandBuffer, mImages[imageIndex],
+                   VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                   VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    // Tightly packed, so the checksum shader doesn't need to know about any row pitch
+    const VkBufferImageCopy copyInfo = {
+            .bufferOffset = 0,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {
+                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .mipLevel = 0,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1,
+            },
+            .imageOffset = {
+                    .x = 0,
+                    .y = 0,
+                    .z = 0,
+            },
+            .imageExtent = {
+                    .width = mImageWidth,
+                    .height = mImageHeight,
+                    .depth = 1,
+            },
+    };
+    if (mHasTimestamps) {
+        mVk.CmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, frame->queryPool,
+                              kTimestampCopyBegin);
+    }
+
+    // A capture goes straight into host memory, and everything after reads it from there
+    mVk.CmdCopyImageToBuffer(commandBuffer, mImages[imageIndex],
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             getCopyBuffer(frame, readback), 1, &copyInfo);
+
+    // The image is done with once it's copied, so it can be presented while the copy is reduced
+    setImageLayout(commandBuffer, mImages[imageIndex],
+                   VK_ACCESS_TRANSFER_READ_BIT, 0,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+    // Otherwise the copy is only read by the YUV conversion submitted after the frame
+    if (readback == Readback::kChecksum || readback == Readback::kCapture) {
+        recordChecksum(commandBuffer, frame, readback);
+    }
+
+    if (mHasTimestamps) {
+        mVk.CmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                              frame->queryPool, kTimestampCopyEnd);
+    }
+
+    if (readback == Readback::kCapture || readback == Readback::kVerify) {
+        const VkBufferMemoryBarrier hostBarrier = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .pNext = nullptr,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = frame->captureBuffer,
+                .offset = 0,
+                .size = VK_WHOLE_SIZE,
+        };
+        mVk.CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &hostBarrier, 0,
+                               nullptr);
+    }
+}
+
+VkBuffer Renderer::getCopyBuffer(const FrameContext* frame, Readback readback) const {
+    return readback == Readback::kCapture || readback == Readback::kVerify ? frame->captureBuffer
+                                                                          : frame->copyBuffer;
+}
+
+void Renderer::recordChecksum(VkCommandBuffer commandBuffer, FrameContext* frame,
+                              Readback readback) {
+    mVk.CmdFillBuffer(commandBuffer, frame->readbackBuffer, 0, VK_WHOLE_SIZE, 0);
+
+    const VkBufferMemoryBarrier transferBarriers[2] = {
+            {
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                    .pNext = nullptr,
+                    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+                    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .buffer = getCopyBuffer(frame, readback),
+                    .offset = 0,
+                    .size = VK_WHOLE_SIZE,
+            },
+            {
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                    .pNext = nullptr,
+                    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                    .buffer = frame->readbackBuffer,
+                    .offset = 0,
+                    .size = VK_WHOLE_SIZE,
+            },
+    };
+    mVk.CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 2,
+                           transferBarriers, 0, nullptr);
+
+    // One workgroup per row
+    const ChecksumPushConstantBlock pushConstants = {
+            .width = mImageWidth,
+            .height = mImageHeight,
+            .isBgra = mFormat == VK_FORMAT_B8G8R8A8_UNORM || mFormat == VK_FORMAT_B8G8R8A8_SRGB,
+    };
+    mVk.CmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mChecksumPipeline);
+    const VkDescriptorSet descriptorSet = readback == Readback::kCapture
+            ? frame->captureChecksumDescriptorSet
+            : frame->checksumDescriptorSet;
+    mVk.CmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                              mChecksumPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    mVk.CmdPushConstants(commandBuffer, mChecksumPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                         sizeof(pushConstants), &pushConstants);
+    mVk.CmdDispatch(commandBuffer, mImageHeight, 1, 1);
+
+    // Make the checksum available to the host once the frame completes
+    const VkBufferMemoryBarrier hostBarrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .pNext = nullptr,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = frame->readbackBuffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+    };
+    mVk.CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &hostBarrier, 0,
+                           nullptr);
+}
+
+void Renderer::recordYuvConversion(VkCommandBuffer commandBuffer, FrameContext* frame,
+                                   uint32_t slot, VkBuffer copyBuffer) {
+    const VkCommandBufferBeginInfo commandBufferBeginInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .pInheritanceInfo = nullptr,
+    };
+    ASSERT(mVk.BeginCommandBuffer(commandBuffer, &commandBufferBeginInfo) == VK_SUCCESS);
+
+    // The copy is written by the frame submitted right before
+    const RecordingSlot& recordingSlot = mRecordingSlots[slot];
+    const VkBufferMemoryBarrier transferBarrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .pNext = nullptr,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = copyBuffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+    };
+    mVk.CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1,
+                           &transferBarrier, 0, nullptr);
+
+    // Each invocation converts one block
+    const YuvPushConstantBlock pushConstants = {
+            .imageWidth = mImageWidth,
+            .imageHeight = mImageHeight,
+            .width = recordingSlot.width,
+            .height = recordingSlot.height,
+            .isBgra = mFormat == VK_FORMAT_B8G8R8A8_UNORM || mFormat == VK_FORMAT_B8G8R8A8_SRGB,
+            .rotation = getQuarterTurns(mPreTransform),
+            .isI420 = mYuvFormat == YuvFormat::kI420,
+    };
+    const uint32_t pixelsPerGroupX = kYuvBlockWidth * kYuvWorkgroupSize;
+    const uint32_t pixelsPerGroupY = kYuvBlockHeight * kYuvWorkgroupSize;
+    mVk.CmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mYuvPipeline);
+    mVk.CmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mYuvPipelineLayout,
+                              0, 1, &frame->yuvDescriptorSets[slot], 0, nullptr);
+    mVk.CmdPushConstants(commandBuffer, mYuvPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                         sizeof(pushConstants), &pushConstants);
+    mVk.CmdDispatch(commandBuffer, (recordingSlot.width + pixelsPerGroupX - 1) / pixelsPerGroupX,
+                    (recordingSlot.height + pixelsPerGroupY - 1) / pixelsPerGroupY, 1);
+
+    // Make the converted frame available to the host once the frame completes
+    const VkBufferMemoryBarrier hostBarrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .pNext = nullptr,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = recordingSlot.buffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+    };
+    mVk.CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &hostBarrier, 0,
+                           nullptr);
+
+    ASSERT(mVk.EndCommandBuffer(commandBuffer) == VK_SUCCESS);
+}
+
+void Renderer::recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t firstDraw,
+                           uint32_t drawCount) {
+    // Dynamic state and bindings are not inherited from the primary command buffer
+    const VkCommandBufferInheritanceInfo inheritanceInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+            .pNext = nullptr,
+            .renderPass = mRenderPass,
+            .subpass = 0,
+            .framebuffer = mFramebuffers[imageIndex],
+            .occlusionQueryEnable = VK_FALSE,
+            .queryFlags = 0,
+            .pipelineStatistics = 0,
+    };
+    const VkCommandBufferBeginInfo commandBufferBeginInfo = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .pNext = nullptr,
+            .flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+            .pInheritanceInfo = &inheritanceInfo,
+    };
+    ASSERT(mVk.BeginCommandBuffer(commandBuffer, &commandBufferBeginInfo) == VK_SUCCESS);
 
     const VkViewport viewport = {
             .x = 0.0F,
@@ -1375,7 +3077,7 @@ void Renderer::recordCommandBuffer(uint32_t frameIndex, uint32_t imageIndex) {
             .minDepth = 0.0F,
             .maxDepth = 1.0F,
     };
-    mVk.CmdSetViewport(mCommandBuffers[frameIndex], 0, 1, &viewport);
+    mVk.CmdSetViewport(commandBuffer, 0, 1, &viewport);
 
     const VkRect2D scissor = {
             .offset =
@@ -1389,11 +3091,12 @@ void Renderer::recordCommandBuffer(uint32_t frameIndex, uint32_t imageIndex) {
                             .height = mImageHeight,
                     },
     };
-    mVk.CmdSetScissor(mCommandBuffers[frameIndex], 0, 1, &scissor);
+    mVk.CmdSetScissor(commandBuffer, 0, 1, &scissor);
 
     // Calculate the simple mvp for this demo
-    const float scaleW = mSurfaceWidth / (float)mTextures[0].width;
-    const float scaleH = mSurfaceHeight / (float)mTextures[0].height;
+    const Texture& texture = mTextures[0].isResident ? mTextures[0] : mPlaceholderTexture;
+    const float scaleW = mSurfaceWidth / (float)texture.width;
+    const float scaleH = mSurfaceHeight / (float)texture.height;
     const float minimalScale = scaleW < scaleH ? scaleW : scaleH;
     const float scaleX = minimalScale / scaleW;
     const float scaleY = minimalScale / scaleH;
@@ -1421,105 +3124,104 @@ void Renderer::recordCommandBuffer(uint32_t frameIndex, uint32_t imageIndex) {
             .mvp = mvp,
             .preRotate = preRotate,
     };
-    mVk.CmdPushConstants(mCommandBuffers[frameIndex], mPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
+    mVk.CmdPushConstants(commandBuffer, mPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT,
                          0, sizeof(PushConstantBlock), &pushConstantBlock);
 
-    mVk.CmdBindPipeline(mCommandBuffers[frameIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, mPipeline);
+    mVk.CmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mPipeline);
 
-    mVk.CmdBindDescriptorSets(mCommandBuffers[frameIndex], VK_PIPELINE_BIND_POINT_GRAPHICS,
+    mVk.CmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                               mPipelineLayout, 0, 1, &mDescriptorSet, 0, nullptr);
 
     const VkDeviceSize offset = 0;
-    mVk.CmdBindVertexBuffers(mCommandBuffers[frameIndex], 0, 1, &mVertexBuffer, &offset);
+    mVk.CmdBindVertexBuffers(commandBuffer, 0, 1, &mVertexBuffer, &offset);
 
-    mVk.CmdDraw(mCommandBuffers[frameIndex], 4, 1, 0, 0);
+    for (uint32_t i = firstDraw; i < firstDraw + drawCount; i++) {
+        mVk.CmdDraw(commandBuffer, mDraws[i].vertexCount, 1, mDraws[i].firstVertex, 0);
+    }
 
-    mVk.CmdEndRenderPass(mCommandBuffers[frameIndex]);
+    ASSERT(mVk.EndCommandBuffer(commandBuffer) == VK_SUCCESS);
+}
 
-    setImageLayout(mCommandBuffers[frameIndex], mImages[imageIndex],
-                   VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
-                   VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                   VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+void Renderer::destroyFramebuffers(std::vector<VkImageView>* imageViews,
+                                   std::vector<VkFramebuffer>* framebuffers) {
+    // Both are created lazily, so images never rendered to have neither
+    for (auto& framebuffer : *framebuffers) {
+        if (framebuffer != VK_NULL_HANDLE) {
+            mVk.DestroyFramebuffer(mDevice, framebuffer, nullptr);
+            mResourceTracker->onDestroy(ResourceTracker::Resource::kFramebuffer);
+        }
+    }
+    framebuffers->clear();
 
-    setImageLayout(mCommandBuffers[frameIndex], mStageImage,
-                   VK_ACCESS_HOST_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
-                   VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                   VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    for (auto& imageView : *imageViews) {
+        if (imageView != VK_NULL_HANDLE) {
+            mVk.DestroyImageView(mDevice, imageView, nullptr);
+            mResourceTracker->onDestroy(ResourceTracker::Resource::kImageView);
+        }
+    }
+    imageViews->clear();
+}
 
-    const VkImageCopy blitInfo = {
-            .srcSubresource = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .mipLevel = 0,
-                    .baseArrayLayer = 0,
-                    .layerCount = 1,
-            },
-            .srcOffset = {
-                    .x = 0,
-                    .y = 0,
-                    .z = 0,
-            },
-            .dstSubresource = {
-                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                    .mipLevel = 0,
-                    .baseArrayLayer = 0,
-                    .layerCount = 1,
-            },
-            .dstOffset = {
-                    .x = 0,
-                    .y = 0,
-                    .z = 0,
-            },
-            .extent = {
-                    .width = mImageWidth,
-                    .height = mImageHeight,
-                    .depth = 1,
-            },
-    };
-    mVk.CmdCopyImage(mCommandBuffers[frameIndex], mImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                     mStageImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitInfo);
+void Renderer::destroyOldSwapchain() {
+    destroyFramebuffers(&mOldImageViews, &mOldFramebuffers);
+    mOldImages.clear();
 
-    setImageLayout(mCommandBuffers[frameIndex], mStageImage,
-                   VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_WRITE_BIT,
-                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
-                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+    if (mOldSwapchain != VK_NULL_HANDLE) {
+        mVk.DestroySwapchainKHR(mDevice, mOldSwapchain, nullptr);
+        mResourceTracker->onDestroy(ResourceTracker::Resource::kSwapchain);
+        mOldSwapchain = VK_NULL_HANDLE;
+    }
 
-    setImageLayout(mCommandBuffers[frameIndex], mImages[imageIndex],
-                   VK_ACCESS_TRANSFER_READ_BIT, 0,
-                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-                   VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    ALOGD("Successfully destroyed old swapchain");
+}
 
-    setImageLayout(mCommandBuffers[frameIndex], mImages[imageIndex],
-                   0, 0,
-                   VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_GENERAL,
-                   VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                   mQueueFamilyIndex, VK_QUEUE_FAMILY_FOREIGN_EXT);
+bool Renderer::isFrameNeeded() {
+    if (!mSkipIdleFrames || mIsContentDirty || mFireRecreateSwapchain) {
+        return true;
+    }
 
-    ASSERT(mVk.EndCommandBuffer(mCommandBuffers[frameIndex]) == VK_SUCCESS);
-}
+    // Textures are streamed in and their staging memory released as frames are drawn
+    if (mResidentTextureCount < mTextures.size() || !mUploadBatches.empty()) {
+        return true;
+    }
 
-void Renderer::destroyOldSwapchain() {
-    for (auto& framebuffer : mOldFramebuffers) {
-        mVk.DestroyFramebuffer(mDevice, framebuffer, nullptr);
+    // Requested readbacks need a frame to read back
+    if (mIsReadbackRequested || mIsScreenshotRequested) {
+        return true;
     }
-    mOldFramebuffers.clear();
 
-    for (auto& imageView : mOldImageViews) {
-        mVk.DestroyImageView(mDevice, imageView, nullptr);
+    if (mForcedFrameInterval && ++mIdleFrameCount >= mForcedFrameInterval) {
+        return true;
     }
-    mOldImageViews.clear();
 
-    mOldImages.clear();
+    // Rotation is otherwise only noticed when present returns VK_SUBOPTIMAL_KHR, so poll the
+    // surface while idle. This is much cheaper than a frame.
+    VkSurfaceCapabilitiesKHR surfaceCapabilities;
+    getSurfaceCapabilities(&surfaceCapabilities);
+    if (surfaceCapabilities.currentTransform != mPreTransform ||
+        surfaceCapabilities.currentExtent.width != mSurfaceWidth ||
+        surfaceCapabilities.currentExtent.height != mSurfaceHeight) {
+        ALOGD("%s[%u] - surface changed while idle", __FUNCTION__, mFrameCount);
+        mFireRecreateSwapchain = true;
+        return true;
+    }
+    return false;
+}
 
-    mVk.DestroySwapchainKHR(mDevice, mOldSwapchain, nullptr);
-    mOldSwapchain = VK_NULL_HANDLE;
+bool Renderer::isFrameVerifiable() {
+    const Texture& texture = mTextures[0];
+    if (!texture.isResident || texture.format != VK_FORMAT_R8G8B8A8_UNORM) {
+        return false;
+    }
 
-    ALOGD("Successfully destroyed old swapchain");
+    // The expected frame models nearest sampling of level 0, which is what the sampler does as
+    // long as the fit in recordDraws doesn't scale the texture down
+    return mSurfaceWidth >= texture.width && mSurfaceHeight >= texture.height;
 }
 
 bool Renderer::is180Rotation() {
     VkSurfaceCapabilitiesKHR surfaceCapabilities;
-    ASSERT(mVk.GetPhysicalDeviceSurfaceCapabilitiesKHR(mGpu, mSurface, &surfaceCapabilities) ==
-           VK_SUCCESS);
+    getSurfaceCapabilities(&surfaceCapabilities);
     VkSurfaceTransformFlagsKHR currentTransform = surfaceCapabilities.currentTransform;
     switch (currentTransform) {
         case VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR:
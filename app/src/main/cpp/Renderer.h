@@ -16,81 +16,483 @@
 
 #pragma once
 
+#ifdef __ANDROID__
 #include <android_native_app_glue.h>
+#endif
 
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "FrameProfiler.h"
+#include "FrameRecorder.h"
+#include "FrameVerifier.h"
+#include "MemoryAllocator.h"
+#include "ResourceTracker.h"
+#include "ScreenshotWriter.h"
+#include "TextureLoader.h"
 #include "VkHelper.h"
+#include "WorkerPool.h"
+
+#ifndef __ANDROID__
+// Host builds render to a headless surface instead of a window
+struct ANativeWindow;
+#endif
 
 class Renderer {
 private:
     struct Texture {
         VkSampler sampler;
         VkImage image;
-        VkDeviceMemory memory;
+        MemoryAllocator::Allocation memory;
         VkImageView view;
+        VkFormat format;
+        uint32_t levelCount;
         uint32_t width;
         uint32_t height;
+        // Whether the descriptor set binds the image rather than the placeholder. Set once the
+        // upload has been submitted, since every later submission is ordered after it.
+        bool isResident;
 
         Texture()
               : sampler(VK_NULL_HANDLE),
                 image(VK_NULL_HANDLE),
-                memory(VK_NULL_HANDLE),
+                memory(),
                 view(VK_NULL_HANDLE),
+                format(VK_FORMAT_UNDEFINED),
+                levelCount(0),
+                width(0),
+                height(0),
+                isResident(false) {}
+    };
+
+    // Any number of image uploads recorded into one command buffer and submitted at once, with
+    // every image staged at its own offset in a single buffer
+    struct UploadBatch {
+        VkCommandBuffer commandBuffer;
+        VkBuffer stagingBuffer;
+        MemoryAllocator::Allocation stagingMemory;
+        // Signals completion when there's no timeline semaphore to wait the serial on
+        VkFence fence;
+        uint64_t serial;
+
+        UploadBatch()
+              : commandBuffer(VK_NULL_HANDLE),
+                stagingBuffer(VK_NULL_HANDLE),
+                stagingMemory(),
+                fence(VK_NULL_HANDLE),
+                serial(0) {}
+    };
+
+    // What a frame reads back once it completes. Each has its own pre-recorded commands.
+    enum class Readback {
+        kNone,
+        // The checksum of the frame
+        kChecksum,
+        // The checksum plus the full frame for a screenshot
+        kCapture,
+        // Only the offscreen copy, for a frame that is recorded but reads back nothing else
+        kCopy,
+        // The full frame to verify it, without the checksum
+        kVerify,
+        kCount,
+    };
+
+    // Everything the commands of a frame depend on. Commands recorded for a key are replayed until
+    // the key changes, e.g. on swapchain recreation.
+    struct CommandKey {
+        VkImage image;
+        VkBuffer readbackBuffer;
+        VkBuffer captureBuffer;
+        VkSurfaceTransformFlagBitsKHR preTransform;
+        uint32_t width;
+        uint32_t height;
+        uint32_t generation;
+
+        CommandKey()
+              : image(VK_NULL_HANDLE),
+                readbackBuffer(VK_NULL_HANDLE),
+                captureBuffer(VK_NULL_HANDLE),
+                preTransform(VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR),
+                width(0),
+                height(0),
+                generation(0) {}
+
+        bool operator==(const CommandKey& other) const {
+            return image == other.image && readbackBuffer == other.readbackBuffer &&
+                    captureBuffer == other.captureBuffer && preTransform == other.preTransform &&
+                    width == other.width && height == other.height &&
+                    generation == other.generation;
+        }
+    };
+
+    struct RecordedCommands {
+        VkCommandBuffer commandBuffer;
+        // Render pass contents executed by commandBuffer, one per recording job
+        std::vector<VkCommandBuffer> secondaryCommandBuffers;
+        CommandKey key;
+        bool isRecorded;
+
+        RecordedCommands()
+              : commandBuffer(VK_NULL_HANDLE),
+                secondaryCommandBuffers(),
+                key(),
+                isRecorded(false) {}
+    };
+
+    // Host memory a recorded frame is converted into on the GPU, handed to the frame recorder once
+    // the frame completes
+    struct RecordingSlot {
+        VkBuffer buffer;
+        // Persistently mapped
+        MemoryAllocator::Allocation memory;
+        VkDeviceSize size;
+        // Size of the YUV frame, upright
+        uint32_t width;
+        uint32_t height;
+        uint32_t frameNumber;
+
+        RecordingSlot()
+              : buffer(VK_NULL_HANDLE),
+                memory(),
+                size(0),
                 width(0),
-                height(0) {}
+                height(0),
+                frameNumber(0) {}
+    };
+
+    // A range of vertices drawn with the textured pipeline
+    struct Draw {
+        uint32_t vertexCount;
+        uint32_t firstVertex;
+    };
+
+    // Everything a single frame touches between recording and GPU completion. These form a ring,
+    // so the CPU can record frame N+1 while the GPU is still executing frame N.
+    struct FrameContext {
+        // Pre-recorded commands for each swapchain image and kind of readback. Indexed by image
+        // index * Readback::kCount + readback
+        std::vector<RecordedCommands> recordedCommands;
+        // One pool per recording job, so worker threads never share a pool
+        std::vector<VkCommandPool> recordingPools;
+        VkSemaphore acquireSemaphore;
+        VkSemaphore renderSemaphore;
+        VkFence inflightFence;
+        // GPU timestamps of the last submission, see kTimestampCount
+        VkQueryPool queryPool;
+        // Offscreen copy of the frame with tightly packed rows. It never leaves device memory, the
+        // checksum shader reduces it into readbackBuffer.
+        VkBuffer copyBuffer;
+        MemoryAllocator::Allocation copyMemory;
+        uint32_t copyWidth;
+        uint32_t copyHeight;
+        // Per-frame checksum of the copy, only read back after inflightFence signals in a later
+        // frame
+        VkBuffer readbackBuffer;
+        MemoryAllocator::Allocation readbackMemory;
+        VkDescriptorSet checksumDescriptorSet;
+        // Host copy of the full frame, only allocated once a frame is captured for a screenshot or
+        // verification. A captured frame is copied here instead of into copyBuffer, and its
+        // checksum reduces it through captureChecksumDescriptorSet.
+        VkBuffer captureBuffer;
+        MemoryAllocator::Allocation captureMemory;
+        VkDescriptorSet captureChecksumDescriptorSet;
+        // Pre-rotation of the captured frame
+        VkSurfaceTransformFlagBitsKHR capturePreTransform;
+        // Whether the captured frame goes to the screenshot writer
+        bool isScreenshot;
+        // Converts the offscreen copy into a recording slot after the frame has been rendered, and
+        // the descriptor set it binds. Indexed by slot
+        std::vector<RecordedCommands> recordingCommands;
+        std::vector<VkDescriptorSet> yuvDescriptorSets;
+        // Recording slot of the last submission, or -1 if it wasn't recorded
+        int32_t recordingSlot;
+        // Submission serial of the last frame recorded into this context
+        uint64_t serial;
+        // Frame count of the last submission recorded into this context
+        uint32_t frameNumber;
+        Readback readback;
+        // Whether the captured frame is compared against the expected image
+        bool isVerified;
+        bool hasTimestamps;
+
+        FrameContext()
+              : recordedCommands(),
+                recordingPools(),
+                acquireSemaphore(VK_NULL_HANDLE),
+                renderSemaphore(VK_NULL_HANDLE),
+                inflightFence(VK_NULL_HANDLE),
+                queryPool(VK_NULL_HANDLE),
+                copyBuffer(VK_NULL_HANDLE),
+                copyMemory(),
+                copyWidth(0),
+                copyHeight(0),
+                readbackBuffer(VK_NULL_HANDLE),
+                readbackMemory(),
+                checksumDescriptorSet(VK_NULL_HANDLE),
+                captureBuffer(VK_NULL_HANDLE),
+                captureMemory(),
+                captureChecksumDescriptorSet(VK_NULL_HANDLE),
+                capturePreTransform(VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR),
+                isScreenshot(false),
+                recordingCommands(),
+                yuvDescriptorSets(),
+                recordingSlot(-1),
+                serial(0),
+                frameNumber(0),
+                readback(Readback::kNone),
+                isVerified(false),
+                hasTimestamps(false) {}
     };
 
 public:
-    explicit Renderer() {}
+    // Trades input-to-photon latency against frame rate
+    enum class LatencyProfile {
+        // MAILBOX or FIFO_RELAXED when supported, the fewest images and a single frame in flight
+        kLowLatency,
+        // FIFO, triple buffering and two frames in flight
+        kBalanced,
+        // FIFO with a deep swapchain and frame queue
+        kThroughput,
+    };
+
+    // Decides at record time whether a frame reads back the checksum of its swapchain image.
+    // Frames without readback leave out the copy, the checksum dispatch and their layout
+    // transitions.
+    enum class ReadbackPolicy {
+        kNever,
+        // Every interval-th frame
+        kEveryNFrames,
+        // Only the frames requested with requestReadback
+        kOnRequest,
+        // The first frame rendered to each image after the swapchain has been recreated, e.g. to
+        // check the pre-rotation
+        kOnTransformChange,
+    };
+
+    struct VerificationStats {
+        uint32_t verifiedFrameCount;
+        // Frames with at least one pixel off by more than the tolerance
+        uint32_t mismatchedFrameCount;
+    };
+
+    // Stage timings of every frame are added to the profiler, screenshots are handed to the
+    // screenshot writer, recorded frames to the frame recorder and live Vulkan objects and device
+    // memory are reported to the resource tracker. All must outlive the renderer.
+    explicit Renderer(FrameProfiler* profiler, ScreenshotWriter* screenshotWriter,
+                      FrameRecorder* frameRecorder, ResourceTracker* resourceTracker)
+          : mProfiler(profiler),
+            mScreenshotWriter(screenshotWriter),
+            mFrameRecorder(frameRecorder),
+            mResourceTracker(resourceTracker) {}
+#ifdef __ANDROID__
     void initialize(ANativeWindow* window, AAssetManager* assetManager);
-    void drawFrame();
+#else
+    // Renders to a VK_EXT_headless_surface, with assets read from a directory
+    void initializeHeadless(uint32_t width, uint32_t height, const char* assetDirectory);
+    // A headless surface never rotates or resizes on its own, so the benchmark scripts both. The
+    // swapchain is recreated on the next frame.
+    void setHeadlessSurface(uint32_t width, uint32_t height,
+                            VkSurfaceTransformFlagBitsKHR transform);
+#endif
+    // Returns false if the frame was skipped because nothing on screen would change
+    bool drawFrame();
     void updateSurface(uint32_t width, uint32_t height);
+    // Takes effect on the next swapchain recreation, which is triggered right away
+    void setLatencyProfile(LatencyProfile profile);
+    // When enabled, frames are only rendered after the texture, surface size or pre-rotation
+    // changed, plus one every forcedFrameInterval skipped frames for readback (0 for none)
+    void setIdleFrameSkipping(bool enabled, uint32_t forcedFrameInterval);
+    // interval is only used by ReadbackPolicy::kEveryNFrames, 0 is taken as 1
+    void setReadbackPolicy(ReadbackPolicy policy, uint32_t interval);
+    // Reads back the next rendered frame, regardless of the policy
+    void requestReadback();
+    // Captures the next rendered frame for the screenshot writer, regardless of the readback
+    // policy. Also renders a frame if idle frames are skipped.
+    void requestScreenshot();
+    // Compares every rendered frame against the image the renderer should have drawn, see
+    // FrameVerifier. Mismatched frames are logged with the count and bounding box of the pixels
+    // with a color channel off by more than the tolerance.
+    void setFrameVerification(bool enabled, uint8_t tolerance);
+    VerificationStats getVerificationStats() const { return mVerificationStats; }
+    MemoryAllocator::Stats getMemoryStats() { return mMemoryAllocator.getStats(); }
+    // Converts every rendered frame to YUV on the GPU, with the pre-rotation undone, and feeds it
+    // to the sink. Frames are dropped while the sink is behind. Stops when the renderer is
+    // destroyed.
+    void startRecording(std::unique_ptr<FrameSink> sink, YuvFormat format);
+    // Waits for the frames in flight and hands them to the sink before stopping it
+    void stopRecording();
     void destroy();
 
 private:
+    struct LatencyProfileInfo {
+        // In order of preference, FIFO is the fallback since it must always be supported
+        VkPresentModeKHR presentModes[3];
+        uint32_t presentModeCount;
+        // 0 means the minimum image count of the surface
+        uint32_t imageCount;
+        uint32_t inflight;
+    };
+    static const LatencyProfileInfo& getLatencyProfileInfo(LatencyProfile profile);
+
+    // A compressed texture format, stored next to each texture file in a KTX2 file of its own
+    struct CompressedFormat {
+        VkFormat format;
+        // Device feature required to sample the format
+        VkBool32 VkPhysicalDeviceFeatures::*feature;
+        // Replaces the extension of the texture file, e.g. sample_tex.astc.ktx2
+        const char* extension;
+    };
+
+private:
+    void createResources(ANativeWindow* window);
     void createInstance();
     void createDevice();
     void createSurface(ANativeWindow* window);
+    void getSurfaceCapabilities(VkSurfaceCapabilitiesKHR* outCapabilities);
     void createSwapchain(VkSwapchainKHR oldSwapchain);
-    uint32_t getMemoryTypeIndex(uint32_t typeBits, VkFlags mask);
+    // A missing optional asset is returned empty
+    std::vector<char> readAsset(const char* filePath, bool isOptional = false);
+    // Host-visible memory stays mapped for as long as the buffer lives. An optional buffer isn't
+    // created close to the memory budget, and false is returned instead.
+    bool createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage,
+                      VkBuffer* outBuffer, MemoryAllocator::Allocation* outMemory,
+                      bool isOptional = false);
+    void destroyBuffer(VkBuffer* buffer, MemoryAllocator::Allocation* memory);
     void setImageLayout(VkCommandBuffer commandBuffer, VkImage image,
                         VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask,
                         VkImageLayout oldImageLayout, VkImageLayout newImageLayout,
                         VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages,
                         uint32_t srcQueue, uint32_t dstQueue);
-    void loadTextureFromFile(const char* filePath, Texture* outTexture);
+    // Transitions levelCount mip levels of a texture, starting with baseLevel
+    void setTextureLayout(VkCommandBuffer commandBuffer, VkImage image, uint32_t baseLevel,
+                          uint32_t levelCount, VkAccessFlags srcAccessMask,
+                          VkAccessFlags dstAccessMask, VkImageLayout oldImageLayout,
+                          VkImageLayout newImageLayout, VkPipelineStageFlags srcStages,
+                          VkPipelineStageFlags dstStages);
+    bool isTextureFormatSupported(VkFormat format);
+    static VkDeviceSize getStagingSize(const TextureLoader::Image& image);
+    // Stages the compressed levels or the decoded pixels of an image at stagingOffset, and records
+    // their copy into a new device-local image for outTexture
+    void recordTextureUpload(UploadBatch* batch, VkDeviceSize stagingOffset,
+                             const TextureLoader::Image& image, Texture* outTexture);
+    // Blits each level of a texture from the one above it, starting from level 0 in
+    // TRANSFER_DST_OPTIMAL, and leaves every level in SHADER_READ_ONLY_OPTIMAL
+    void recordMipGeneration(VkCommandBuffer commandBuffer, const Texture& texture);
+    void createTextureView(Texture* texture);
+    void destroyTexture(Texture* texture);
+    // The staging buffer is only created for a non-zero stagingSize
+    void beginUploadBatch(VkDeviceSize stagingSize, UploadBatch* outBatch);
+    // Ends the command buffer of the batch and submits it without waiting
+    void submitUploadBatch(UploadBatch* batch);
+    bool isUploadBatchComplete(const UploadBatch& batch);
+    void destroyUploadBatch(UploadBatch* batch);
+    void createPlaceholderTexture();
     void createTextures();
+    // Submits the images decoded since the last frame, and frees uploads the GPU has completed
+    void streamTextures();
     void createDescriptorSet();
+    // Allocates a new set, since the current one may still be in use by frames in flight
+    void updateDescriptorSet();
     void createRenderPass();
     void loadShaderFromFile(const char* filePath, VkShaderModule* outShader);
     void createGraphicsPipeline();
+    void createComputePipeline(const char* shaderFile, uint32_t pushConstantSize,
+                               VkDescriptorSetLayout* outSetLayout,
+                               VkPipelineLayout* outPipelineLayout, VkPipeline* outPipeline);
+    void createComputePipelines();
     void createVertexBuffer();
-    void createCommandBuffers();
+    void createCommandPool();
+    void createRecordingPools(FrameContext* frame);
+    void createFrameContexts(uint32_t count);
+    void destroyFrameContexts();
     void createSemaphore(VkSemaphore* outSemaphore);
     void createSemaphores();
     void createFences();
+    void createQueryPools();
+    void createFrameDescriptorSets();
+    void createTimelineSemaphore();
+    // trailingCommandBuffer is optional, and executes after signalSemaphore has been signaled
+    uint64_t queueSubmit(VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore,
+                         VkPipelineStageFlags waitStageMask, VkSemaphore signalSemaphore,
+                         VkFence fence, VkCommandBuffer trailingCommandBuffer);
+    void waitForSerial(uint64_t serial);
+    bool isSerialComplete(uint64_t serial);
     void createFramebuffer(uint32_t index);
-    void recordCommandBuffer(uint32_t frameIndex, uint32_t imageIndex);
+    void createReadbackBuffer(FrameContext* frame);
+    void destroyReadbackBuffer(FrameContext* frame);
+    // Both return false if there's no memory left for the optional buffer
+    bool createCaptureBuffer(FrameContext* frame);
+    void readbackFrame(FrameContext* frame);
+    void captureFrame(FrameContext* frame, const void* pixels);
+    void verifyFrame(FrameContext* frame, const void* pixels);
+    bool prepareRecordingSlot(uint32_t slot);
+    void destroyRecordingSlots();
+    void readbackRecording(FrameContext* frame);
+    void readTimestamps(FrameContext* frame);
+    Readback getReadback();
+    VkCommandBuffer getCommandBuffer(FrameContext* frame, uint32_t imageIndex, Readback readback);
+    void recordCommandBuffer(VkCommandBuffer commandBuffer, FrameContext* frame,
+                             uint32_t imageIndex, Readback readback,
+                             const std::vector<VkCommandBuffer>& secondaryCommandBuffers);
+    void recordReadback(VkCommandBuffer commandBuffer, FrameContext* frame, uint32_t imageIndex,
+                        Readback readback);
+    // Buffer the swapchain image of a frame is copied into for the given readback
+    VkBuffer getCopyBuffer(const FrameContext* frame, Readback readback) const;
+    void recordChecksum(VkCommandBuffer commandBuffer, FrameContext* frame, Readback readback);
+    VkCommandBuffer getRecordingCommandBuffer(FrameContext* frame, uint32_t slot,
+                                              Readback readback);
+    void recordYuvConversion(VkCommandBuffer commandBuffer, FrameContext* frame, uint32_t slot,
+                             VkBuffer copyBuffer);
+    void recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t firstDraw,
+                     uint32_t drawCount);
+    void destroyFramebuffers(std::vector<VkImageView>* imageViews,
+                             std::vector<VkFramebuffer>* framebuffers);
     void destroyOldSwapchain();
     bool is180Rotation();
+    bool isFrameNeeded();
+    // The first texture is drawn, its pixels are known to build the expected frame from, and it's
+    // magnified so only its level 0 is sampled
+    bool isFrameVerifiable();
 
     // Helper member for Vulkan entry points
     VkHelper mVk;
+    // Every buffer and image is bound to memory from here
+    MemoryAllocator mMemoryAllocator;
+#ifdef __ANDROID__
     // A pointer to cache AAssetManager
     AAssetManager* mAssetManager = nullptr;
+#else
+    std::string mAssetDirectory;
+    // Scripted state of the headless surface, the extent is in the rotated orientation
+    uint32_t mHeadlessWidth = 0;
+    uint32_t mHeadlessHeight = 0;
+    VkSurfaceTransformFlagBitsKHR mHeadlessTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+#endif
+    FrameProfiler* mProfiler = nullptr;
+    ScreenshotWriter* mScreenshotWriter = nullptr;
+    FrameRecorder* mFrameRecorder = nullptr;
+    ResourceTracker* mResourceTracker = nullptr;
 
     // Stable baseline members
     VkInstance mInstance = VK_NULL_HANDLE;
     VkPhysicalDevice mGpu = VK_NULL_HANDLE;
     VkDevice mDevice = VK_NULL_HANDLE;
+    // Only the texture compression features that are supported
+    VkPhysicalDeviceFeatures mEnabledFeatures = {};
     uint32_t mQueueFamilyIndex = 0;
     VkQueue mQueue = VK_NULL_HANDLE;
+    // Queue family that owns the swapchain images between our submissions
+    uint32_t mExternalQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 
     // Swapchain related members
     VkSurfaceKHR mSurface = VK_NULL_HANDLE;
     VkFormat mFormat = VK_FORMAT_UNDEFINED;
     VkColorSpaceKHR mColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+    std::vector<VkPresentModeKHR> mPresentModes;
+    LatencyProfile mLatencyProfile = LatencyProfile::kBalanced;
+    LatencyProfile mPendingLatencyProfile = LatencyProfile::kBalanced;
+    VkPresentModeKHR mPresentMode = VK_PRESENT_MODE_FIFO_KHR;
     uint32_t mSurfaceWidth = 0;
     uint32_t mSurfaceHeight = 0;
     uint32_t mImageWidth = 0;
@@ -101,26 +503,69 @@ private:
     std::vector<VkImage> mImages;
     std::vector<VkImageView> mImageViews;
     std::vector<VkFramebuffer> mFramebuffers;
-    VkImage mStageImage = VK_NULL_HANDLE;
-    VkMemoryRequirements mStageMemoryRequirements;
-    VkDeviceMemory mStageMemory = VK_NULL_HANDLE;
-    VkSubresourceLayout mStageSubresourceLayout;
+    // Submission serial of the last frame rendering to each swapchain image
+    std::vector<uint64_t> mImageSerials;
 
-    // For swapchain recreation, old stuff can be refactored to kInflight buffered
+    // For swapchain recreation, old stuff can be refactored to inflight buffered
     bool mFireRecreateSwapchain = false;
     uint32_t mPreRotationLatency = kPreRotationLatency;
-    uint32_t mRetireFrame = 0;
+    uint64_t mRetireSerial = 0;
     VkSwapchainKHR mOldSwapchain = VK_NULL_HANDLE;
     std::vector<VkImage> mOldImages;
     std::vector<VkImageView> mOldImageViews;
     std::vector<VkFramebuffer> mOldFramebuffers;
 
+    // Idle-frame skipping related members. The content is dirty until a frame has been rendered
+    // with the current swapchain and textures.
+    bool mSkipIdleFrames = false;
+    uint32_t mForcedFrameInterval = 0;
+    bool mIsContentDirty = true;
+    uint32_t mIdleFrameCount = 0;
+    uint32_t mSkippedFrameCount = 0;
+
+    // Readback related members
+    ReadbackPolicy mReadbackPolicy = ReadbackPolicy::kEveryNFrames;
+    uint32_t mReadbackInterval = kLogInterval;
+    bool mIsReadbackRequested = false;
+    bool mIsScreenshotRequested = false;
+    bool mIsVerifyingFrames = false;
+    FrameVerifier mFrameVerifier;
+    VerificationStats mVerificationStats = {};
+    // Frames rendered since the swapchain was created
+    uint32_t mSwapchainFrameCount = 0;
+
     // Graphics pipeline related members
     VkRenderPass mRenderPass = VK_NULL_HANDLE;
     VkPipelineLayout mPipelineLayout = VK_NULL_HANDLE;
     VkPipeline mPipeline = VK_NULL_HANDLE;
 
-    // Descriptor related members
+    // Compute pipeline related members. The pool holds the checksum and YUV descriptor sets of
+    // every frame context.
+    VkDescriptorSetLayout mChecksumSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout mChecksumPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline mChecksumPipeline = VK_NULL_HANDLE;
+    VkDescriptorSetLayout mYuvSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout mYuvPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline mYuvPipeline = VK_NULL_HANDLE;
+    VkDescriptorPool mFrameDescriptorPool = VK_NULL_HANDLE;
+
+    // Recording related members. The slots are allocated on the first recorded frame and kept
+    // across recording sessions.
+    YuvFormat mYuvFormat = YuvFormat::kNv12;
+    std::vector<RecordingSlot> mRecordingSlots;
+
+    // Texture streaming related members. Textures are decoded by the loader and bound in place of
+    // the placeholder once their upload has been submitted.
+    TextureLoader mTextureLoader;
+    Texture mPlaceholderTexture;
+    VkCommandPool mUploadCommandPool = VK_NULL_HANDLE;
+    std::vector<UploadBatch> mUploadBatches;
+    uint32_t mResidentTextureCount = 0;
+    // Decoded textures get a full mip chain blitted on the GPU if their format allows it
+    bool mIsMipGenerationSupported = false;
+
+    // Descriptor related members. The pool holds the set binding the placeholders plus one set per
+    // upload batch at most, so sets replaced while in flight are simply left in the pool.
     std::vector<Texture> mTextures;
     VkDescriptorSetLayout mDescriptorSetLayout = VK_NULL_HANDLE;
     VkDescriptorPool mDescriptorPool = VK_NULL_HANDLE;
@@ -128,18 +573,33 @@ private:
 
     // Vertex buffer related members
     VkBuffer mVertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory mVertexMemory = VK_NULL_HANDLE;
+    MemoryAllocator::Allocation mVertexMemory;
+    std::vector<Draw> mDraws;
 
     // Command buffer related members
     VkCommandPool mCommandPool = VK_NULL_HANDLE;
-    std::vector<VkCommandBuffer> mCommandBuffers;
+    // Bumped to invalidate every pre-recorded command buffer
+    uint32_t mCommandGeneration = 0;
+    // Records the render pass contents in parallel, each job into its own secondary command buffer
+    std::unique_ptr<WorkerPool> mRecordingWorkers;
+    uint32_t mRecordingJobCount = 0;
 
-    // Semaphores for synchronization
-    std::vector<VkSemaphore> mAcquireSemaphores;
-    std::vector<VkSemaphore> mRenderSemaphores;
+    // Every queue submission gets a serial. With VK_KHR_timeline_semaphore the serial is the value
+    // signaled on mTimeline, so completion is a single counter and no per-frame fences are needed.
+    // Otherwise completion is learned from the inflight fences of the frame contexts.
+    bool mUseTimeline = false;
+    VkSemaphore mTimeline = VK_NULL_HANDLE;
+    uint64_t mSubmitSerial = 0;
+    uint64_t mCompletedSerial = 0;
 
-    // Fences for latency control
-    std::vector<VkFence> mInflightFences;
+    // GPU timing is only available when the graphics queue supports timestamps
+    bool mHasTimestamps = false;
+    float mTimestampPeriod = 0.0F;
+    uint64_t mTimestampMask = 0;
+
+    // Per-frame command buffers, sync objects and readback targets, indexed by mFrameCount. The
+    // ring size is the inflight depth of the current latency profile.
+    std::vector<FrameContext> mFrames;
 
     // App specific constants
     static constexpr const char *kRequiredInstanceLayers[1] = {
@@ -147,20 +607,62 @@ private:
     };
     static constexpr const char* kRequiredInstanceExtensions[2] = {
             "VK_KHR_surface",
+#ifdef __ANDROID__
             "VK_KHR_android_surface",
+#else
+            "VK_EXT_headless_surface",
+#endif
     };
     static constexpr const char* kRequiredDeviceExtensions[1] = {
             "VK_KHR_swapchain",
     };
-    static constexpr const uint32_t kReqImageCount = 3;
-    static constexpr const uint32_t kInflight = 2;
+    static constexpr const char* kTimelineSemaphoreExtension = "VK_KHR_timeline_semaphore";
+    // Enabled when supported, otherwise the budget is estimated from the heap sizes
+    static constexpr const char* kMemoryBudgetExtension = "VK_EXT_memory_budget";
+    // Use the timeline semaphore backend when the device supports it
+    static constexpr const bool kPreferTimelineSemaphore = true;
     static constexpr const uint32_t kTextureCount = 1;
+    // In order of preference. A texture is loaded from the first compressed variant that is
+    // supported and exists, and otherwise decoded from its file on the CPU.
+    static constexpr const CompressedFormat kCompressedFormats[3] = {
+            {VK_FORMAT_ASTC_4x4_UNORM_BLOCK, &VkPhysicalDeviceFeatures::textureCompressionASTC_LDR,
+             ".astc.ktx2"},
+            {VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, &VkPhysicalDeviceFeatures::textureCompressionETC2,
+             ".etc2.ktx2"},
+            {VK_FORMAT_BC7_UNORM_BLOCK, &VkPhysicalDeviceFeatures::textureCompressionBC,
+             ".bc7.ktx2"},
+    };
+    // Offset alignment of each image or mip level in the staging buffer of an upload batch, a
+    // multiple of the 16 byte blocks of the compressed formats
+    static constexpr const VkDeviceSize kStagingAlignment = 16;
+    static constexpr const VkFormatFeatureFlags kMipGenerationFeatures =
+            VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
     static constexpr const char* kTextureFiles[kTextureCount] = {
             "sample_tex.png",
     };
+    // Bound until a texture is resident
+    static constexpr const float kPlaceholderColor[4] = {0.5F, 0.5F, 0.5F, 1.0F};
     static constexpr const char* kVertexShaderFile = "texture.vert.spv";
     static constexpr const char* kFragmentShaderFile = "texture.frag.spv";
+    // Compiled from src/main/shaders at build time
+    static constexpr const char* kChecksumShaderFile = "shaders/checksum.comp.spv";
+    static constexpr const char* kYuvShaderFile = "shaders/yuv.comp.spv";
+    // Output pixels converted by each invocation of the YUV shader, and its workgroup size
+    static constexpr const uint32_t kYuvBlockWidth = 8;
+    static constexpr const uint32_t kYuvBlockHeight = 2;
+    static constexpr const uint32_t kYuvWorkgroupSize = 8;
     static constexpr const uint32_t kLogInterval = 100;
+    static constexpr const uint32_t kProfileLogInterval = 600;
+    // Timestamp queries written by every frame. The copy pair spans the offscreen copy and the
+    // checksum dispatch of frames that read back.
+    static constexpr const uint32_t kTimestampRenderPassBegin = 0;
+    static constexpr const uint32_t kTimestampRenderPassEnd = 1;
+    static constexpr const uint32_t kTimestampCopyBegin = 2;
+    static constexpr const uint32_t kTimestampCopyEnd = 3;
+    static constexpr const uint32_t kTimestampCount = 4;
     static constexpr const uint64_t kTimeout30Sec = 30000000000;
     static constexpr const uint32_t kPreRotationLatency = 30;
+    // Recording threads besides the render thread, also bounded by the core count
+    static constexpr const uint32_t kMaxRecordingWorkers = 3;
 };
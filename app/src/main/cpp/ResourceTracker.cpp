@@ -0,0 +1,114 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ResourceTracker.h"
+
+#include <algorithm>
+
+#include "Utils.h"
+
+void ResourceTracker::onCreate(Resource resource) {
+    const uint32_t index = static_cast<uint32_t>(resource);
+    ASSERT(index < kResourceCount);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    Count& count = mStats.counts[index];
+    count.live++;
+    count.peak = std::max(count.peak, count.live);
+}
+
+void ResourceTracker::onDestroy(Resource resource) {
+    const uint32_t index = static_cast<uint32_t>(resource);
+    ASSERT(index < kResourceCount);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    ASSERT(mStats.counts[index].live > 0);
+    mStats.counts[index].live--;
+}
+
+void ResourceTracker::onAllocate(uint32_t heapIndex, VkDeviceSize size) {
+    ASSERT(heapIndex < VK_MAX_MEMORY_HEAPS);
+    onCreate(Resource::kDeviceMemory);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    Heap& heap = mStats.heaps[heapIndex];
+    heap.allocatedBytes += size;
+    heap.peakAllocatedBytes = std::max(heap.peakAllocatedBytes, heap.allocatedBytes);
+    mStats.heapCount = std::max(mStats.heapCount, heapIndex + 1);
+}
+
+void ResourceTracker::onFree(uint32_t heapIndex, VkDeviceSize size) {
+    ASSERT(heapIndex < VK_MAX_MEMORY_HEAPS);
+    onDestroy(Resource::kDeviceMemory);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    ASSERT(mStats.heaps[heapIndex].allocatedBytes >= size);
+    mStats.heaps[heapIndex].allocatedBytes -= size;
+}
+
+void ResourceTracker::setHeapBudget(uint32_t heapIndex, VkDeviceSize heapSize,
+                                    VkDeviceSize budgetBytes, VkDeviceSize usageBytes) {
+    ASSERT(heapIndex < VK_MAX_MEMORY_HEAPS);
+
+    std::lock_guard<std::mutex> lock(mLock);
+    Heap& heap = mStats.heaps[heapIndex];
+    heap.size = heapSize;
+    heap.budgetBytes = budgetBytes;
+    heap.usageBytes = usageBytes;
+    mStats.heapCount = std::max(mStats.heapCount, heapIndex + 1);
+}
+
+ResourceTracker::Stats ResourceTracker::getStats() const {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mStats;
+}
+
+void ResourceTracker::logStats() const {
+    const Stats stats = getStats();
+    for (uint32_t i = 0; i < kResourceCount; i++) {
+        ALOGD("%s: %-16s live[%u] peak[%u]", __FUNCTION__,
+              getResourceName(static_cast<Resource>(i)), stats.counts[i].live,
+              stats.counts[i].peak);
+    }
+    for (uint32_t i = 0; i < stats.heapCount; i++) {
+        const Heap& heap = stats.heaps[i];
+        ALOGD("%s: heap %u allocated[%lluKiB] peak[%lluKiB] usage[%lluKiB] budget[%lluKiB]",
+              __FUNCTION__, i, (unsigned long long)(heap.allocatedBytes >> 10),
+              (unsigned long long)(heap.peakAllocatedBytes >> 10),
+              (unsigned long long)(heap.usageBytes >> 10),
+              (unsigned long long)(heap.budgetBytes >> 10));
+    }
+}
+
+const char* ResourceTracker::getResourceName(Resource resource) {
+    switch (resource) {
+        case Resource::kDeviceMemory:
+            return "DeviceMemory";
+        case Resource::kBuffer:
+            return "Buffer";
+        case Resource::kImage:
+            return "Image";
+        case Resource::kImageView:
+            return "ImageView";
+        case Resource::kFramebuffer:
+            return "Framebuffer";
+        case Resource::kSwapchain:
+            return "Swapchain";
+        default:
+            break;
+    }
+    return "Unknown";
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <mutex>
+
+// ResourceTracker counts the live Vulkan objects of the renderer by kind, and the device memory it
+// holds per heap, along with their high-water marks. The render thread and the memory allocator
+// report, any thread can read the stats. A count that doesn't return to zero once the device is
+// destroyed is a leak.
+class ResourceTracker {
+public:
+    enum class Resource {
+        // VkDeviceMemory, blocks and dedicated allocations alike
+        kDeviceMemory,
+        kBuffer,
+        kImage,
+        kImageView,
+        kFramebuffer,
+        kSwapchain,
+        kCount,
+    };
+
+    struct Count {
+        uint32_t live;
+        uint32_t peak;
+    };
+
+    struct Heap {
+        VkDeviceSize size;
+        // Device memory held by the renderer
+        VkDeviceSize allocatedBytes;
+        VkDeviceSize peakAllocatedBytes;
+        // From VK_EXT_memory_budget when supported, where usage includes every other process.
+        // Otherwise an estimate from the heap size, and usage is allocatedBytes.
+        VkDeviceSize budgetBytes;
+        VkDeviceSize usageBytes;
+    };
+
+    struct Stats {
+        Count counts[static_cast<uint32_t>(Resource::kCount)];
+        uint32_t heapCount;
+        Heap heaps[VK_MAX_MEMORY_HEAPS];
+    };
+
+    explicit ResourceTracker() {}
+    void onCreate(Resource resource);
+    void onDestroy(Resource resource);
+    // Also counts the VkDeviceMemory
+    void onAllocate(uint32_t heapIndex, VkDeviceSize size);
+    void onFree(uint32_t heapIndex, VkDeviceSize size);
+    void setHeapBudget(uint32_t heapIndex, VkDeviceSize heapSize, VkDeviceSize budgetBytes,
+                       VkDeviceSize usageBytes);
+    Stats getStats() const;
+    void logStats() const;
+    static const char* getResourceName(Resource resource);
+
+private:
+    static constexpr const uint32_t kResourceCount = static_cast<uint32_t>(Resource::kCount);
+
+    mutable std::mutex mLock;
+    Stats mStats = {};
+};
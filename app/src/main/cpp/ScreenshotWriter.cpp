@@ -0,0 +1,178 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ScreenshotWriter.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <ctime>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include "Utils.h"
+
+// Maps the pixel at x, y of the frame as displayed back to the pre-rotated image. The renderer
+// rotates the content clockwise by the pre-transform, so this rotates it back counterclockwise.
+static uint32_t getSourceIndex(const ScreenshotWriter::Capture& capture, uint32_t x, uint32_t y) {
+    const uint32_t width = capture.width;
+    const uint32_t height = capture.height;
+    switch (capture.preTransform) {
+        case VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR:
+            return x * width + (width - 1 - y);
+        case VK_SURFACE_TRANSFORM_ROTATE_180_BIT_KHR:
+            return (height - 1 - y) * width + (width - 1 - x);
+        case VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR:
+            return (height - 1 - x) * width + y;
+        default:
+            return y * width + x;
+    }
+}
+
+ScreenshotWriter::ScreenshotWriter() {
+    mThread = std::thread(&ScreenshotWriter::writerLoop, this);
+}
+
+ScreenshotWriter::~ScreenshotWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mQuit = true;
+    }
+    mCondition.notify_one();
+    mThread.join();
+}
+
+void ScreenshotWriter::setDirectory(const std::string& directory) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mDirectory = directory;
+}
+
+bool ScreenshotWriter::submit(Capture* capture) {
+    ASSERT(capture && capture->pixels.size() == size_t(capture->width) * capture->height * 4);
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (mCaptures.size() >= kMaxPendingCaptures) {
+            return false;
+        }
+        mCaptures.emplace_back(std::move(*capture));
+    }
+    mCondition.notify_one();
+    return true;
+}
+
+void ScreenshotWriter::writerLoop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        mCondition.wait(lock, [this] { return mQuit || !mCaptures.empty(); });
+        // Pending captures are still written on quit, they were requested after all
+        if (mCaptures.empty()) {
+            return;
+        }
+
+        const Capture capture = std::move(mCaptures.front());
+        mCaptures.pop_front();
+        const std::string directory = mDirectory;
+        const uint32_t sequence = mSequence++;
+
+        lock.unlock();
+        write(capture, directory, sequence);
+        lock.lock();
+    }
+}
+
+void ScreenshotWriter::write(const Capture& capture, const std::string& directory,
+                             uint32_t sequence) {
+    if (directory.empty()) {
+        ALOGD("%s: no directory set, dropped frame %u", __FUNCTION__, capture.frameNumber);
+        return;
+    }
+
+    const bool isRotated = capture.preTransform == VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR ||
+                           capture.preTransform == VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR;
+    const uint32_t width = isRotated ? capture.height : capture.width;
+    const uint32_t height = isRotated ? capture.width : capture.height;
+
+    // Un-rotate and convert to opaque RGBA in a single pass
+    std::vector<uint8_t> pixels(size_t(width) * height * 4);
+    const uint8_t* src = capture.pixels.data();
+    uint8_t* dst = pixels.data();
+    const uint32_t redOffset = capture.isBgra ? 2 : 0;
+    const uint32_t blueOffset = capture.isBgra ? 0 : 2;
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint8_t* pixel = src + size_t(getSourceIndex(capture, x, y)) * 4;
+            dst[0] = pixel[redOffset];
+            dst[1] = pixel[1];
+            dst[2] = pixel[blueOffset];
+            dst[3] = 0xFF;
+            dst += 4;
+        }
+    }
+
+    std::string path;
+    FILE* file = createFile(directory, sequence, &path);
+    if (!file) {
+        ALOGD("%s: failed to create a file in %s, dropped frame %u", __FUNCTION__,
+              directory.c_str(), capture.frameNumber);
+        return;
+    }
+    const auto writeToFile = [](void* context, void* data, int size) {
+        fwrite(data, 1, size_t(size), static_cast<FILE*>(context));
+    };
+    const bool isWritten = stbi_write_png_to_func(writeToFile, file, int(width), int(height), 4,
+                                                  pixels.data(), int(width * 4)) &&
+            !ferror(file);
+    if (fclose(file) != 0 || !isWritten) {
+        ALOGD("%s: failed to write %s", __FUNCTION__, path.c_str());
+        unlink(path.c_str());
+        return;
+    }
+    ALOGD("%s: frame %u as %ux%u to %s", __FUNCTION__, capture.frameNumber, width, height,
+          path.c_str());
+}
+
+FILE* ScreenshotWriter::createFile(const std::string& directory, uint32_t sequence,
+                                   std::string* outPath) {
+    char timestamp[32];
+    const time_t now = time(nullptr);
+    tm localTime;
+    localtime_r(&now, &localTime);
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S", &localTime);
+
+    const std::string name =
+            directory + "/screenshot_" + timestamp + "_" + std::to_string(sequence);
+    for (uint32_t attempt = 0; attempt < kMaxNameAttempts; attempt++) {
+        *outPath = name + (attempt ? "_" + std::to_string(attempt) : "") + ".png";
+        // Fails for a name that exists, rather than truncating the file
+        const int fd = open(outPath->c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            if (errno == EEXIST) {
+                continue;
+            }
+            return nullptr;
+        }
+        FILE* file = fdopen(fd, "wb");
+        if (!file) {
+            close(fd);
+            unlink(outPath->c_str());
+        }
+        return file;
+    }
+    return nullptr;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Un-rotates, converts and PNG-encodes captured frames on its own thread, so the render thread
+// never waits for encoding or file I/O. Existing files are never overwritten. All public APIs are
+// thread safe.
+class ScreenshotWriter {
+public:
+    // A frame as it was copied out of the swapchain image, before the pre-rotation is undone
+    struct Capture {
+        // Tightly packed rows with 4 bytes per pixel
+        std::vector<uint8_t> pixels;
+        uint32_t width;
+        uint32_t height;
+        VkSurfaceTransformFlagBitsKHR preTransform;
+        bool isBgra;
+        uint32_t frameNumber;
+
+        Capture()
+              : pixels(),
+                width(0),
+                height(0),
+                preTransform(VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR),
+                isBgra(false),
+                frameNumber(0) {}
+    };
+
+    explicit ScreenshotWriter();
+    ~ScreenshotWriter();
+    // Applies to the captures written from now on
+    void setDirectory(const std::string& directory);
+    // Takes the pixels of the capture. Returns false if kMaxPendingCaptures are already waiting to
+    // be written, in which case the capture is dropped.
+    bool submit(Capture* capture);
+
+private:
+    void writerLoop();
+    void write(const Capture& capture, const std::string& directory, uint32_t sequence);
+    // Creates a new file named after the wall-clock time and the sequence, as the sequence starts
+    // over in every process. Returns null if no free name was found.
+    static FILE* createFile(const std::string& directory, uint32_t sequence,
+                            std::string* outPath);
+
+    std::thread mThread;
+
+    // mLock protects the members below
+    std::mutex mLock;
+    std::condition_variable mCondition;
+    std::deque<Capture> mCaptures;
+    std::string mDirectory;
+    uint32_t mSequence = 0;
+    bool mQuit = false;
+
+    // Each capture holds a full frame, so only a few are allowed to pile up
+    static constexpr const uint32_t kMaxPendingCaptures = 2;
+    // Suffixes tried when the name of a capture is taken already
+    static constexpr const uint32_t kMaxNameAttempts = 100;
+};
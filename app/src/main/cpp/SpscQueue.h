@@ -0,0 +1,62 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread
+template <typename T, uint32_t kCapacity>
+class SpscQueue {
+    static_assert(kCapacity && (kCapacity & (kCapacity - 1)) == 0,
+                  "kCapacity must be a power of two");
+
+public:
+    explicit SpscQueue() {}
+
+    // Producer side, returns false if the queue is full
+    bool push(const T& item) {
+        const uint32_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mHead.load(std::memory_order_acquire) == kCapacity) {
+            return false;
+        }
+        mItems[tail & kMask] = item;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, returns false if the queue is empty
+    bool pop(T* outItem) {
+        const uint32_t head = mHead.load(std::memory_order_relaxed);
+        if (head == mTail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *outItem = mItems[head & kMask];
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static constexpr const uint32_t kMask = kCapacity - 1;
+    static constexpr const size_t kCacheLineSize = 64;
+
+    // Head and tail live on separate cache lines so the two threads don't false share
+    alignas(kCacheLineSize) std::atomic<uint32_t> mHead{0};
+    alignas(kCacheLineSize) std::atomic<uint32_t> mTail{0};
+    alignas(kCacheLineSize) T mItems[kCapacity];
+};
@@ -0,0 +1,277 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TextureLoader.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+#include "Utils.h"
+#include "WorkerPool.h"
+
+void TextureLoader::PixelDeleter::operator()(uint8_t* pixels) const {
+    stbi_image_free(pixels);
+}
+
+static void expandRgbRow(const uint8_t* src, uint32_t width, uint8_t* dst) {
+    uint32_t x = 0;
+#if defined(__SSSE3__)
+    // Each iteration expands 4 pixels from a 16 byte load, which must stay within the row
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000U));
+    for (; x + 6 <= width; x += 4) {
+        const __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4),
+                         _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+    }
+#elif defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16) {
+        const uint8x16x3_t rgb = vld3q_u8(src + x * 3);
+        const uint8x16x4_t rgba = {{rgb.val[0], rgb.val[1], rgb.val[2], vdupq_n_u8(0xFF)}};
+        vst4q_u8(dst + x * 4, rgba);
+    }
+#endif
+    for (; x < width; x++) {
+        dst[x * 4 + 0] = src[x * 3 + 0];
+        dst[x * 4 + 1] = src[x * 3 + 1];
+        dst[x * 4 + 2] = src[x * 3 + 2];
+        dst[x * 4 + 3] = 0xFF;
+    }
+}
+
+static void expandGreyRow(const uint8_t* src, uint32_t width, bool hasAlpha, uint8_t* dst) {
+    const uint32_t channelCount = hasAlpha ? 2 : 1;
+    for (uint32_t x = 0; x < width; x++) {
+        const uint8_t grey = src[x * channelCount];
+        dst[x * 4 + 0] = grey;
+        dst[x * 4 + 1] = grey;
+        dst[x * 4 + 2] = grey;
+        dst[x * 4 + 3] = hasAlpha ? src[x * channelCount + 1] : 0xFF;
+    }
+}
+
+void TextureLoader::copyToRgba(const Image& image, uint8_t* dst, size_t dstRowPitch) {
+    const uint8_t* src = image.pixels.get();
+    const size_t srcRowSize = size_t(image.width) * image.channelCount;
+    const size_t dstRowSize = size_t(image.width) * 4;
+    ASSERT(dstRowPitch >= dstRowSize);
+
+    // RGBA with tightly packed rows on both sides is a single copy
+    if (image.channelCount == 4 && dstRowPitch == dstRowSize) {
+        memcpy(dst, src, dstRowSize * image.height);
+        return;
+    }
+
+    for (uint32_t row = 0; row < image.height; row++) {
+        switch (image.channelCount) {
+            case 1:
+            case 2:
+                expandGreyRow(src, image.width, image.channelCount == 2, dst);
+                break;
+            case 3:
+                expandRgbRow(src, image.width, dst);
+                break;
+            case 4:
+                memcpy(dst, src, dstRowSize);
+                break;
+            default:
+                ASSERT(false);
+        }
+        src += srcRowSize;
+        dst += dstRowPitch;
+    }
+}
+
+TextureLoader::~TextureLoader() {
+    stop();
+}
+
+void TextureLoader::start(const std::vector<std::vector<std::string>>& filePaths,
+                          ReadFunction readFile) {
+    ASSERT(!mThread.joinable());
+    mIsStopping = false;
+    mThread = std::thread(&TextureLoader::loaderLoop, this, filePaths, std::move(readFile));
+}
+
+void TextureLoader::takeImages(std::vector<Image>* outImages) {
+    std::lock_guard<std::mutex> lock(mLock);
+    for (auto& image : mImages) {
+        outImages->push_back(std::move(image));
+    }
+    mImages.clear();
+}
+
+void TextureLoader::stop() {
+    if (!mThread.joinable()) {
+        return;
+    }
+    mIsStopping = true;
+    mThread.join();
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mImages.clear();
+}
+
+void TextureLoader::loaderLoop(std::vector<std::vector<std::string>> filePaths,
+                               ReadFunction readFile) {
+    // The loader thread decodes too, and the pool only lives as long as there are files to decode
+    const uint32_t textureCount = static_cast<uint32_t>(filePaths.size());
+    const uint32_t coreCount = std::thread::hardware_concurrency();
+    const uint32_t workerCount = std::min({kMaxDecodeWorkers, coreCount > 1 ? coreCount - 1 : 0,
+                                           textureCount > 1 ? textureCount - 1 : 0});
+    WorkerPool workers(workerCount);
+
+    workers.parallelFor(textureCount, [&](uint32_t index) {
+        if (mIsStopping) {
+            return;
+        }
+
+        Image image;
+        image.index = index;
+        const char* filePath = nullptr;
+        for (const auto& candidate : filePaths[index]) {
+            std::vector<char> file = readFile(candidate.c_str());
+            if (file.empty()) {
+                continue;
+            }
+            if (!isKtx2(file)) {
+                decodeImage(file, &image);
+            } else if (!parseKtx2(&file, &image)) {
+                ALOGD("TextureLoader: skipped %s, malformed or unsupported KTX2",
+                      candidate.c_str());
+                continue;
+            }
+            filePath = candidate.c_str();
+            break;
+        }
+        ASSERT(filePath);
+        ALOGD("TextureLoader: loaded %s, %ux%u with format %d and %zu levels", filePath,
+              image.width, image.height, image.format,
+              image.isCompressed() ? image.levels.size() : 1);
+
+        std::lock_guard<std::mutex> lock(mLock);
+        mImages.push_back(std::move(image));
+    });
+}
+
+void TextureLoader::decodeImage(const std::vector<char>& file, Image* image) {
+    int width = 0;
+    int height = 0;
+    int channelCount = 0;
+    // Decoding to the channels of the file skips the conversion pass and extra image buffer stb
+    // would otherwise make for anything but RGBA
+    image->pixels.reset(stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(file.data()),
+                                              static_cast<int>(file.size()), &width, &height,
+                                              &channelCount, 0 /*desired_channels*/));
+    ASSERT(image->pixels);
+    ASSERT(width > 0 && height > 0);
+    ASSERT(channelCount >= 1 && channelCount <= 4);
+    image->width = static_cast<uint32_t>(width);
+    image->height = static_cast<uint32_t>(height);
+    image->format = VK_FORMAT_R8G8B8A8_UNORM;
+    image->channelCount = static_cast<uint32_t>(channelCount);
+}
+
+// KTX2 is little-endian, like every platform the renderer runs on
+template <typename T>
+static T readKtx2(const std::vector<char>& file, size_t offset) {
+    T value;
+    memcpy(&value, file.data() + offset, sizeof(value));
+    return value;
+}
+
+bool TextureLoader::isKtx2(const std::vector<char>& file) {
+    static constexpr const uint8_t kIdentifier[12] = {
+            0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n',
+    };
+    return file.size() >= sizeof(kIdentifier) &&
+            memcmp(file.data(), kIdentifier, sizeof(kIdentifier)) == 0;
+}
+
+bool TextureLoader::parseKtx2(std::vector<char>* file, Image* image) {
+    if (file->size() < kKtx2HeaderSize) {
+        return false;
+    }
+    const auto format = static_cast<VkFormat>(readKtx2<uint32_t>(*file, 12));
+    const uint32_t width = readKtx2<uint32_t>(*file, 20);
+    const uint32_t height = readKtx2<uint32_t>(*file, 24);
+    const uint32_t depth = readKtx2<uint32_t>(*file, 28);
+    const uint32_t layerCount = readKtx2<uint32_t>(*file, 32);
+    const uint32_t faceCount = readKtx2<uint32_t>(*file, 36);
+    // 0 asks the loader to generate the mip levels, which isn't possible for compressed blocks
+    const uint32_t levelCount = std::max(readKtx2<uint32_t>(*file, 40), 1U);
+    const uint32_t supercompressionScheme = readKtx2<uint32_t>(*file, 44);
+
+    // Only 2D textures with their blocks stored as is
+    const BlockFormat* blockFormat = nullptr;
+    for (const auto& candidate : kKtx2Formats) {
+        if (candidate.format == format) {
+            blockFormat = &candidate;
+        }
+    }
+    if (!blockFormat || !width || !height || depth != 0 || layerCount > 1 || faceCount != 1 ||
+        supercompressionScheme != 0) {
+        return false;
+    }
+
+    // No more levels than halving the larger side down to 1
+    uint32_t maxLevelCount = 0;
+    while (std::max(width, height) >> maxLevelCount) {
+        maxLevelCount++;
+    }
+    if (levelCount > maxLevelCount ||
+        file->size() < kKtx2HeaderSize + levelCount * kKtx2LevelIndexEntrySize) {
+        return false;
+    }
+
+    // Each level must hold exactly the blocks covering its extent, as that's what the copy to the
+    // image reads. Sizes are checked in 64 bits, before anything is narrowed to size_t.
+    const uint64_t fileSize = file->size();
+    std::vector<Level> levels(levelCount);
+    for (uint32_t i = 0; i < levelCount; i++) {
+        const size_t entryOffset = kKtx2HeaderSize + i * kKtx2LevelIndexEntrySize;
+        const uint64_t offset = readKtx2<uint64_t>(*file, entryOffset);
+        const uint64_t size = readKtx2<uint64_t>(*file, entryOffset + 8);
+        Level& level = levels[i];
+        level.width = std::max(width >> i, 1U);
+        level.height = std::max(height >> i, 1U);
+        const uint64_t blockCount =
+                uint64_t((level.width + blockFormat->blockWidth - 1) / blockFormat->blockWidth) *
+                ((level.height + blockFormat->blockHeight - 1) / blockFormat->blockHeight);
+        if (offset > fileSize || size > fileSize - offset ||
+            blockCount > fileSize / blockFormat->blockSize ||
+            size != blockCount * blockFormat->blockSize) {
+            return false;
+        }
+        level.offset = static_cast<size_t>(offset);
+        level.size = static_cast<size_t>(size);
+    }
+    image->width = width;
+    image->height = height;
+    image->format = format;
+    image->levels = std::move(levels);
+    image->data = std::move(*file);
+    return true;
+}
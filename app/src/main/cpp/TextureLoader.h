@@ -0,0 +1,131 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads and decodes texture files in the background, so neither initialization nor the render
+// thread waits for file I/O or PNG decoding. A loader thread spreads the files over a worker pool,
+// and each image is handed over as soon as it has been decoded. KTX2 files aren't decoded at all,
+// their compressed mip levels are handed over as stored. The APIs are called from a single thread.
+class TextureLoader {
+public:
+    struct PixelDeleter {
+        void operator()(uint8_t* pixels) const;
+    };
+
+    // A mip level of a KTX2 file
+    struct Level {
+        // Of the level in Image::data
+        size_t offset;
+        size_t size;
+        uint32_t width;
+        uint32_t height;
+
+        Level() : offset(0), size(0), width(0), height(0) {}
+    };
+
+    struct Image {
+        // Index of the texture in the list passed to start
+        uint32_t index;
+        // Of level 0
+        uint32_t width;
+        uint32_t height;
+        // VK_FORMAT_R8G8B8A8_UNORM for images decoded on the CPU
+        VkFormat format;
+        // Channels as stored in the file, from 1 for grey to 4 for RGBA. Converting to RGBA is
+        // left to copyToRgba, so the pixels are only copied once on their way to the GPU.
+        uint32_t channelCount;
+        // Tightly packed rows of a decoded image
+        std::unique_ptr<uint8_t, PixelDeleter> pixels;
+        // The whole KTX2 file and its levels, largest first. Empty for a decoded image.
+        std::vector<char> data;
+        std::vector<Level> levels;
+
+        Image()
+              : index(0),
+                width(0),
+                height(0),
+                format(VK_FORMAT_UNDEFINED),
+                channelCount(0),
+                pixels(),
+                data(),
+                levels() {}
+        bool isCompressed() const { return !levels.empty(); }
+    };
+
+    // Called on worker threads, so it must be thread safe. Returns nothing for a missing file.
+    using ReadFunction = std::function<std::vector<char>(const char* filePath)>;
+
+    explicit TextureLoader() {}
+    ~TextureLoader();
+    // Returns right away, the files are decoded in the background. Each texture lists the files
+    // it can be loaded from in order of preference, and the first one that exists is loaded.
+    void start(const std::vector<std::vector<std::string>>& filePaths, ReadFunction readFile);
+    // Moves the images decoded since the last call to the back of outImages. Never blocks on
+    // decoding.
+    void takeImages(std::vector<Image>* outImages);
+    // Files not being decoded yet are skipped, and images not taken yet are dropped
+    void stop();
+    // Writes the image as RGBA rows dstRowPitch bytes apart, e.g. straight into mapped staging
+    // memory. Grey is replicated to RGB, and a missing alpha is opaque.
+    static void copyToRgba(const Image& image, uint8_t* dst, size_t dstRowPitch);
+
+private:
+    // A block compressed format KTX2 files may hold
+    struct BlockFormat {
+        VkFormat format;
+        uint32_t blockWidth;
+        uint32_t blockHeight;
+        uint32_t blockSize;
+    };
+
+    void loaderLoop(std::vector<std::vector<std::string>> filePaths, ReadFunction readFile);
+    static void decodeImage(const std::vector<char>& file, Image* image);
+    static bool isKtx2(const std::vector<char>& file);
+    // Takes a KTX2 file whose levels match their format and extent. Otherwise returns false and
+    // leaves both alone, so the next file of the texture can be tried.
+    static bool parseKtx2(std::vector<char>* file, Image* image);
+
+    std::thread mThread;
+    std::atomic<bool> mIsStopping{false};
+
+    // mLock protects the member below
+    std::mutex mLock;
+    std::vector<Image> mImages;
+
+    // Decoding threads besides the loader thread, also bounded by the core count
+    static constexpr const uint32_t kMaxDecodeWorkers = 3;
+    // The KTX2 header is followed by the level index, with an offset, size and uncompressed size
+    // for each level
+    static constexpr const size_t kKtx2HeaderSize = 80;
+    static constexpr const size_t kKtx2LevelIndexEntrySize = 24;
+    static constexpr const BlockFormat kKtx2Formats[3] = {
+            {VK_FORMAT_ASTC_4x4_UNORM_BLOCK, 4, 4, 16},
+            {VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, 4, 4, 16},
+            {VK_FORMAT_BC7_UNORM_BLOCK, 4, 4, 16},
+    };
+};
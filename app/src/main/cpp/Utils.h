@@ -16,9 +16,15 @@
 
 #pragma once
 
+#ifdef __ANDROID__
 #include <android/log.h>
+#else
+#include <cstdio>
+#include <cstdlib>
+#endif
 
 #define LOG_TAG "VKDEMO"
+#ifdef __ANDROID__
 #define ALOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
 #define ALOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, __VA_ARGS__)
 #define ASSERT(cond)                                                                               \
@@ -27,3 +33,15 @@
             __android_log_assert(#cond, LOG_TAG, "Error: " #cond " at " __FILE__ ":%d", __LINE__); \
         }                                                                                          \
     } while (0)
+#else
+// Host builds, e.g. the headless benchmark, log to stderr. The format must be a string literal.
+#define ALOGD(format, ...) fprintf(stderr, LOG_TAG " D " format "\n", ##__VA_ARGS__)
+#define ALOGV(format, ...) fprintf(stderr, LOG_TAG " V " format "\n", ##__VA_ARGS__)
+#define ASSERT(cond)                                                                               \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            fprintf(stderr, LOG_TAG " Error: " #cond " at " __FILE__ ":%d\n", __LINE__);          \
+            abort();                                                                               \
+        }                                                                                          \
+    } while (0)
+#endif
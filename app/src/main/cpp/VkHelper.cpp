@@ -28,17 +28,25 @@ void VkHelper::initializeGlobalApi() {
 }
 
 void VkHelper::initializeInstanceApi(VkInstance instance) {
+#ifdef VK_USE_PLATFORM_ANDROID_KHR
     GET_INST_PROC(CreateAndroidSurfaceKHR);
+#endif
     GET_INST_PROC(CreateDevice);
+    GET_INST_PROC(CreateHeadlessSurfaceEXT);
     GET_INST_PROC(DestroyInstance);
     GET_INST_PROC(DestroySurfaceKHR);
     GET_INST_PROC(EnumerateDeviceExtensionProperties);
     GET_INST_PROC(EnumeratePhysicalDevices);
     GET_INST_PROC(GetDeviceProcAddr);
+    GET_INST_PROC(GetPhysicalDeviceFeatures);
+    GET_INST_PROC(GetPhysicalDeviceFeatures2);
     GET_INST_PROC(GetPhysicalDeviceMemoryProperties);
     GET_INST_PROC(GetPhysicalDeviceFormatProperties);
+    GET_INST_PROC(GetPhysicalDeviceMemoryProperties2);
+    GET_INST_PROC(GetPhysicalDeviceProperties);
     GET_INST_PROC(GetPhysicalDeviceQueueFamilyProperties);
     GET_INST_PROC(GetPhysicalDeviceSurfaceFormatsKHR);
+    GET_INST_PROC(GetPhysicalDeviceSurfacePresentModesKHR);
     GET_INST_PROC(GetPhysicalDeviceSurfaceSupportKHR);
     GET_INST_PROC(GetPhysicalDeviceSurfaceCapabilitiesKHR);
 }
@@ -55,15 +63,24 @@ void VkHelper::initializeDeviceApi(VkDevice device) {
     GET_DEV_PROC(CmdBindDescriptorSets);
     GET_DEV_PROC(CmdBindPipeline);
     GET_DEV_PROC(CmdBindVertexBuffers);
-    GET_DEV_PROC(CmdCopyImage);
+    GET_DEV_PROC(CmdBlitImage);
+    GET_DEV_PROC(CmdClearColorImage);
+    GET_DEV_PROC(CmdCopyBufferToImage);
+    GET_DEV_PROC(CmdCopyImageToBuffer);
+    GET_DEV_PROC(CmdDispatch);
     GET_DEV_PROC(CmdDraw);
     GET_DEV_PROC(CmdEndRenderPass);
+    GET_DEV_PROC(CmdExecuteCommands);
+    GET_DEV_PROC(CmdFillBuffer);
     GET_DEV_PROC(CmdPipelineBarrier);
     GET_DEV_PROC(CmdPushConstants);
+    GET_DEV_PROC(CmdResetQueryPool);
     GET_DEV_PROC(CmdSetScissor);
     GET_DEV_PROC(CmdSetViewport);
+    GET_DEV_PROC(CmdWriteTimestamp);
     GET_DEV_PROC(CreateBuffer);
     GET_DEV_PROC(CreateCommandPool);
+    GET_DEV_PROC(CreateComputePipelines);
     GET_DEV_PROC(CreateDescriptorPool);
     GET_DEV_PROC(CreateDescriptorSetLayout);
     GET_DEV_PROC(CreateFence);
@@ -72,6 +89,7 @@ void VkHelper::initializeDeviceApi(VkDevice device) {
     GET_DEV_PROC(CreateImage);
     GET_DEV_PROC(CreateImageView);
     GET_DEV_PROC(CreatePipelineLayout);
+    GET_DEV_PROC(CreateQueryPool);
     GET_DEV_PROC(CreateRenderPass);
     GET_DEV_PROC(CreateSampler);
     GET_DEV_PROC(CreateSemaphore);
@@ -88,6 +106,7 @@ void VkHelper::initializeDeviceApi(VkDevice device) {
     GET_DEV_PROC(DestroyImageView);
     GET_DEV_PROC(DestroyPipeline);
     GET_DEV_PROC(DestroyPipelineLayout);
+    GET_DEV_PROC(DestroyQueryPool);
     GET_DEV_PROC(DestroyRenderPass);
     GET_DEV_PROC(DestroySampler);
     GET_DEV_PROC(DestroySemaphore);
@@ -95,14 +114,20 @@ void VkHelper::initializeDeviceApi(VkDevice device) {
     GET_DEV_PROC(DestroySwapchainKHR);
     GET_DEV_PROC(DeviceWaitIdle);
     GET_DEV_PROC(EndCommandBuffer);
+    GET_DEV_PROC(FlushMappedMemoryRanges);
     GET_DEV_PROC(FreeCommandBuffers);
     GET_DEV_PROC(FreeDescriptorSets);
     GET_DEV_PROC(FreeMemory);
     GET_DEV_PROC(GetBufferMemoryRequirements);
+    GET_DEV_PROC(GetBufferMemoryRequirements2);
     GET_DEV_PROC(GetDeviceQueue);
+    GET_DEV_PROC(GetFenceStatus);
     GET_DEV_PROC(GetImageMemoryRequirements);
-    GET_DEV_PROC(GetImageSubresourceLayout);
+    GET_DEV_PROC(GetImageMemoryRequirements2);
+    GET_DEV_PROC(GetQueryPoolResults);
+    GET_DEV_PROC(GetSemaphoreCounterValueKHR);
     GET_DEV_PROC(GetSwapchainImagesKHR);
+    GET_DEV_PROC(InvalidateMappedMemoryRanges);
     GET_DEV_PROC(MapMemory);
     GET_DEV_PROC(QueuePresentKHR);
     GET_DEV_PROC(QueueSubmit);
@@ -110,4 +135,5 @@ void VkHelper::initializeDeviceApi(VkDevice device) {
     GET_DEV_PROC(UnmapMemory);
     GET_DEV_PROC(UpdateDescriptorSets);
     GET_DEV_PROC(WaitForFences);
+    GET_DEV_PROC(WaitSemaphoresKHR);
 }
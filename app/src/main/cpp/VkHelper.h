@@ -32,17 +32,25 @@ public:
     PFN_vkEnumerateInstanceVersion EnumerateInstanceVersion = nullptr;
 
     // GET_INSTANCE_PROC functions
+#ifdef VK_USE_PLATFORM_ANDROID_KHR
     PFN_vkCreateAndroidSurfaceKHR CreateAndroidSurfaceKHR = nullptr;
+#endif
     PFN_vkCreateDevice CreateDevice = nullptr;
+    PFN_vkCreateHeadlessSurfaceEXT CreateHeadlessSurfaceEXT = nullptr;
     PFN_vkDestroyInstance DestroyInstance = nullptr;
     PFN_vkDestroySurfaceKHR DestroySurfaceKHR = nullptr;
     PFN_vkEnumerateDeviceExtensionProperties EnumerateDeviceExtensionProperties = nullptr;
     PFN_vkEnumeratePhysicalDevices EnumeratePhysicalDevices = nullptr;
     PFN_vkGetDeviceProcAddr GetDeviceProcAddr = nullptr;
+    PFN_vkGetPhysicalDeviceFeatures GetPhysicalDeviceFeatures = nullptr;
+    PFN_vkGetPhysicalDeviceFeatures2 GetPhysicalDeviceFeatures2 = nullptr;
     PFN_vkGetPhysicalDeviceFormatProperties GetPhysicalDeviceFormatProperties = nullptr;
     PFN_vkGetPhysicalDeviceMemoryProperties GetPhysicalDeviceMemoryProperties = nullptr;
+    PFN_vkGetPhysicalDeviceMemoryProperties2 GetPhysicalDeviceMemoryProperties2 = nullptr;
+    PFN_vkGetPhysicalDeviceProperties GetPhysicalDeviceProperties = nullptr;
     PFN_vkGetPhysicalDeviceSurfaceCapabilitiesKHR GetPhysicalDeviceSurfaceCapabilitiesKHR = nullptr;
     PFN_vkGetPhysicalDeviceSurfaceFormatsKHR GetPhysicalDeviceSurfaceFormatsKHR = nullptr;
+    PFN_vkGetPhysicalDeviceSurfacePresentModesKHR GetPhysicalDeviceSurfacePresentModesKHR = nullptr;
     PFN_vkGetPhysicalDeviceSurfaceSupportKHR GetPhysicalDeviceSurfaceSupportKHR = nullptr;
     PFN_vkGetPhysicalDeviceQueueFamilyProperties GetPhysicalDeviceQueueFamilyProperties = nullptr;
 
@@ -58,15 +66,24 @@ public:
     PFN_vkCmdBindDescriptorSets CmdBindDescriptorSets = nullptr;
     PFN_vkCmdBindPipeline CmdBindPipeline = nullptr;
     PFN_vkCmdBindVertexBuffers CmdBindVertexBuffers = nullptr;
-    PFN_vkCmdCopyImage CmdCopyImage = nullptr;
+    PFN_vkCmdBlitImage CmdBlitImage = nullptr;
+    PFN_vkCmdClearColorImage CmdClearColorImage = nullptr;
+    PFN_vkCmdCopyBufferToImage CmdCopyBufferToImage = nullptr;
+    PFN_vkCmdCopyImageToBuffer CmdCopyImageToBuffer = nullptr;
+    PFN_vkCmdDispatch CmdDispatch = nullptr;
     PFN_vkCmdDraw CmdDraw = nullptr;
     PFN_vkCmdEndRenderPass CmdEndRenderPass = nullptr;
+    PFN_vkCmdExecuteCommands CmdExecuteCommands = nullptr;
+    PFN_vkCmdFillBuffer CmdFillBuffer = nullptr;
     PFN_vkCmdPipelineBarrier CmdPipelineBarrier = nullptr;
     PFN_vkCmdPushConstants CmdPushConstants = nullptr;
+    PFN_vkCmdResetQueryPool CmdResetQueryPool = nullptr;
     PFN_vkCmdSetScissor CmdSetScissor = nullptr;
     PFN_vkCmdSetViewport CmdSetViewport = nullptr;
+    PFN_vkCmdWriteTimestamp CmdWriteTimestamp = nullptr;
     PFN_vkCreateBuffer CreateBuffer = nullptr;
     PFN_vkCreateCommandPool CreateCommandPool = nullptr;
+    PFN_vkCreateComputePipelines CreateComputePipelines = nullptr;
     PFN_vkCreateDescriptorPool CreateDescriptorPool = nullptr;
     PFN_vkCreateDescriptorSetLayout CreateDescriptorSetLayout = nullptr;
     PFN_vkCreateFence CreateFence = nullptr;
@@ -75,6 +92,7 @@ public:
     PFN_vkCreateImage CreateImage = nullptr;
     PFN_vkCreateImageView CreateImageView = nullptr;
     PFN_vkCreatePipelineLayout CreatePipelineLayout = nullptr;
+    PFN_vkCreateQueryPool CreateQueryPool = nullptr;
     PFN_vkCreateRenderPass CreateRenderPass = nullptr;
     PFN_vkCreateSampler CreateSampler = nullptr;
     PFN_vkCreateSemaphore CreateSemaphore = nullptr;
@@ -91,6 +109,7 @@ public:
     PFN_vkDestroyImageView DestroyImageView = nullptr;
     PFN_vkDestroyPipeline DestroyPipeline = nullptr;
     PFN_vkDestroyPipelineLayout DestroyPipelineLayout = nullptr;
+    PFN_vkDestroyQueryPool DestroyQueryPool = nullptr;
     PFN_vkDestroyRenderPass DestroyRenderPass = nullptr;
     PFN_vkDestroySampler DestroySampler = nullptr;
     PFN_vkDestroySemaphore DestroySemaphore = nullptr;
@@ -98,14 +117,20 @@ public:
     PFN_vkDestroySwapchainKHR DestroySwapchainKHR = nullptr;
     PFN_vkDeviceWaitIdle DeviceWaitIdle = nullptr;
     PFN_vkEndCommandBuffer EndCommandBuffer = nullptr;
+    PFN_vkFlushMappedMemoryRanges FlushMappedMemoryRanges = nullptr;
     PFN_vkFreeCommandBuffers FreeCommandBuffers = nullptr;
     PFN_vkFreeDescriptorSets FreeDescriptorSets = nullptr;
     PFN_vkFreeMemory FreeMemory = nullptr;
     PFN_vkGetBufferMemoryRequirements GetBufferMemoryRequirements = nullptr;
+    PFN_vkGetBufferMemoryRequirements2 GetBufferMemoryRequirements2 = nullptr;
     PFN_vkGetDeviceQueue GetDeviceQueue = nullptr;
+    PFN_vkGetFenceStatus GetFenceStatus = nullptr;
     PFN_vkGetImageMemoryRequirements GetImageMemoryRequirements = nullptr;
-    PFN_vkGetImageSubresourceLayout GetImageSubresourceLayout = nullptr;
+    PFN_vkGetImageMemoryRequirements2 GetImageMemoryRequirements2 = nullptr;
+    PFN_vkGetQueryPoolResults GetQueryPoolResults = nullptr;
+    PFN_vkGetSemaphoreCounterValueKHR GetSemaphoreCounterValueKHR = nullptr;
     PFN_vkGetSwapchainImagesKHR GetSwapchainImagesKHR = nullptr;
+    PFN_vkInvalidateMappedMemoryRanges InvalidateMappedMemoryRanges = nullptr;
     PFN_vkMapMemory MapMemory = nullptr;
     PFN_vkQueuePresentKHR QueuePresentKHR = nullptr;
     PFN_vkQueueSubmit QueueSubmit = nullptr;
@@ -113,4 +138,5 @@ public:
     PFN_vkUnmapMemory UnmapMemory = nullptr;
     PFN_vkUpdateDescriptorSets UpdateDescriptorSets = nullptr;
     PFN_vkWaitForFences WaitForFences = nullptr;
+    PFN_vkWaitSemaphoresKHR WaitSemaphoresKHR = nullptr;
 };
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(uint32_t threadCount) {
+    for (uint32_t i = 0; i < threadCount; i++) {
+        mThreads.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mQuit = true;
+    }
+    mWorkCondition.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::parallelFor(uint32_t jobCount, const std::function<void(uint32_t)>& job) {
+    if (jobCount == 0) {
+        return;
+    }
+
+    Batch batch;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mJob = &job;
+        mJobCount = jobCount;
+        mPendingJobs = jobCount;
+        mGeneration++;
+        mCursor.store(uint64_t(mGeneration) << 32, std::memory_order_relaxed);
+        batch = {mJob, mJobCount, mGeneration};
+    }
+    mWorkCondition.notify_all();
+
+    runJobs(batch);
+
+    std::unique_lock<std::mutex> lock(mLock);
+    mDoneCondition.wait(lock, [this] { return mPendingJobs == 0; });
+    mJob = nullptr;
+}
+
+void WorkerPool::workerLoop() {
+    uint32_t generation = 0;
+    std::unique_lock<std::mutex> lock(mLock);
+    while (true) {
+        mWorkCondition.wait(lock,
+                            [this, generation] { return mQuit || mGeneration != generation; });
+        if (mQuit) {
+            return;
+        }
+        generation = mGeneration;
+        // Read under the lock, so the job and its count belong to the generation woken for. A
+        // late worker may see a finished call, whose jobs are all claimed already.
+        const Batch batch = {mJob, mJobCount, mGeneration};
+
+        lock.unlock();
+        runJobs(batch);
+        lock.lock();
+    }
+}
+
+void WorkerPool::runJobs(const Batch& batch) {
+    const uint64_t generation = uint64_t(batch.generation) << 32;
+    uint64_t cursor = mCursor.load(std::memory_order_relaxed);
+    while (true) {
+        // Stop once every job is claimed, or the next call already moved the cursor on
+        if ((cursor >> 32 << 32) != generation || uint32_t(cursor) >= batch.jobCount) {
+            return;
+        }
+        if (!mCursor.compare_exchange_weak(cursor, cursor + 1, std::memory_order_relaxed)) {
+            continue;
+        }
+        (*batch.job)(uint32_t(cursor));
+
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            if (--mPendingJobs == 0) {
+                mDoneCondition.notify_one();
+            }
+        }
+        cursor = mCursor.load(std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads running parallel-for style jobs. The calling thread takes part in
+// the work too, so a pool of N threads runs up to N + 1 jobs at once.
+class WorkerPool {
+public:
+    explicit WorkerPool(uint32_t threadCount);
+    ~WorkerPool();
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(mThreads.size()); }
+    // Runs job(0) to job(jobCount - 1) and returns once all of them are done. Only one thread may
+    // call this at a time.
+    void parallelFor(uint32_t jobCount, const std::function<void(uint32_t)>& job);
+
+private:
+    // A parallelFor call, as seen by a thread taking part in it
+    struct Batch {
+        const std::function<void(uint32_t)>* job;
+        uint32_t jobCount;
+        uint32_t generation;
+    };
+
+    void workerLoop();
+    void runJobs(const Batch& batch);
+
+    std::vector<std::thread> mThreads;
+
+    // mLock protects the members below, except the job cursor which workers claim lock-free
+    std::mutex mLock;
+    std::condition_variable mWorkCondition;
+    std::condition_variable mDoneCondition;
+    const std::function<void(uint32_t)>* mJob = nullptr;
+    uint32_t mJobCount = 0;
+    uint32_t mPendingJobs = 0;
+    uint32_t mGeneration = 0;
+    bool mQuit = false;
+    // The generation of the current call in the upper half, and the next job to claim in the lower
+    // half. A claim compares both, so a worker still finishing a call never claims a job of the
+    // next one.
+    std::atomic<uint64_t> mCursor{0};
+};
@@ -16,6 +16,7 @@
 
 #include <android/choreographer.h>
 #include <android_native_app_glue.h>
+#include <unistd.h>
 
 #include "Engine.h"
 #include "Utils.h"
@@ -33,7 +34,8 @@ static void onChoreographer(int64_t frameTimeNanos, void* data) {
     AChoreographer_postFrameCallbackDelayed64(AChoreographer_getInstance(), onChoreographer, engine,
                                               engine->getDelayMillis(frameTimeNanos));
 
-    engine->drawFrame();
+    // Rendering happens on the render thread, so the looper thread only kicks off the frame here
+    engine->requestFrame();
 }
 
 static void handleAppCmd(android_app* app, int32_t cmd) {
@@ -44,6 +46,20 @@ static void handleAppCmd(android_app* app, int32_t cmd) {
             AChoreographer_postFrameCallback64(AChoreographer_getInstance(), onChoreographer,
                                                engine);
             break;
+        case APP_CMD_WINDOW_RESIZED: {
+            if (app->window == nullptr) {
+                break;
+            }
+            const int32_t width = ANativeWindow_getWidth(app->window);
+            const int32_t height = ANativeWindow_getHeight(app->window);
+            ALOGD("%s: W[%d], H[%d]", __FUNCTION__, width, height);
+
+            if (width < 0 || height < 0) {
+                break;
+            }
+            engine->onWindowResized((uint32_t)width, (uint32_t)height);
+            break;
+        }
         case APP_CMD_TERM_WINDOW:
             engine->onTermWindow();
             break;
@@ -52,16 +68,15 @@ static void handleAppCmd(android_app* app, int32_t cmd) {
     }
 }
 
-static void handleNativeWindowResized(ANativeActivity* activity, ANativeWindow* window) {
-    auto engine = static_cast<Engine*>(static_cast<android_app*>(activity->instance)->userData);
-    const int32_t width = ANativeWindow_getWidth(window);
-    const int32_t height = ANativeWindow_getHeight(window);
-    ALOGD("%s: W[%d], H[%d]", __FUNCTION__, width, height);
-
-    if (width < 0 || height < 0) {
-        return;
+static void handleNativeWindowResized(ANativeActivity* activity, ANativeWindow* /*window*/) {
+    // This runs on the activity's UI thread. Forward it to the looper thread the same way
+    // native_app_glue forwards its own commands, so the looper thread stays the only thread that
+    // feeds events to the render thread.
+    auto app = static_cast<android_app*>(activity->instance);
+    const int8_t cmd = APP_CMD_WINDOW_RESIZED;
+    if (write(app->msgwrite, &cmd, sizeof(cmd)) != sizeof(cmd)) {
+        ALOGD("%s: failed to forward resize", __FUNCTION__);
     }
-    engine->onWindowResized((uint32_t)width, (uint32_t)height);
 }
 
 void android_main(android_app* app) {
@@ -71,6 +86,14 @@ void android_main(android_app* app) {
     app->onAppCmd = handleAppCmd;
     app->activity->callbacks->onNativeWindowResized = handleNativeWindowResized;
 
+    // The external files directory can be pulled with adb without root
+    const char* screenshotDirectory = app->activity->externalDataPath
+                                              ? app->activity->externalDataPath
+                                              : app->activity->internalDataPath;
+    if (screenshotDirectory) {
+        engine.setScreenshotDirectory(screenshotDirectory);
+    }
+
     if (AChoreographer_getInstance() == nullptr) {
         return;
     }
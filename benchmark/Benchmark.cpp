@@ -0,0 +1,231 @@
+/*
+ * Copyright 2019 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "FrameProfiler.h"
+#include "FrameRecorder.h"
+#include "RawFileSink.h"
+#include "Renderer.h"
+#include "ScreenshotWriter.h"
+#include "Utils.h"
+
+struct Options {
+    uint32_t frameCount = 1000;
+    uint32_t width = 1080;
+    uint32_t height = 1920;
+    // Rotates the emulated display by 90 degrees every so many frames, 0 to never rotate
+    uint32_t rotationInterval = 250;
+    Renderer::LatencyProfile latencyProfile = Renderer::LatencyProfile::kBalanced;
+    const char* assetDirectory = VKBENCH_ASSET_DIR;
+    // Per-frame timings are written here as CSV if set
+    const char* csvPath = nullptr;
+    // The first frame after each rotation is saved here as PNG if set
+    const char* screenshotDirectory = nullptr;
+    // Every frame is recorded here as raw NV12 if set
+    const char* recordPath = nullptr;
+    // Every frame is compared with the expected image, allowing this much per channel, if set
+    int32_t verifyTolerance = -1;
+};
+
+static void printUsage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [--frames N] [--size WxH] [--rotate-every N]\n"
+            "       [--profile low|balanced|throughput] [--assets DIR] [--csv FILE]\n"
+            "       [--screenshots DIR] [--record FILE] [--verify TOLERANCE]\n",
+            program);
+}
+
+static bool parseOptions(int argc, char** argv, Options* outOptions) {
+    for (int i = 1; i < argc; i++) {
+        const char* option = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+
+        if (strcmp(option, "--frames") == 0) {
+            outOptions->frameCount = (uint32_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(option, "--size") == 0) {
+            if (sscanf(value, "%ux%u", &outOptions->width, &outOptions->height) != 2) {
+                return false;
+            }
+        } else if (strcmp(option, "--rotate-every") == 0) {
+            outOptions->rotationInterval = (uint32_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(option, "--profile") == 0) {
+            if (strcmp(value, "low") == 0) {
+                outOptions->latencyProfile = Renderer::LatencyProfile::kLowLatency;
+            } else if (strcmp(value, "balanced") == 0) {
+                outOptions->latencyProfile = Renderer::LatencyProfile::kBalanced;
+            } else if (strcmp(value, "throughput") == 0) {
+                outOptions->latencyProfile = Renderer::LatencyProfile::kThroughput;
+            } else {
+                return false;
+            }
+        } else if (strcmp(option, "--assets") == 0) {
+            outOptions->assetDirectory = value;
+        } else if (strcmp(option, "--csv") == 0) {
+            outOptions->csvPath = value;
+        } else if (strcmp(option, "--screenshots") == 0) {
+            outOptions->screenshotDirectory = value;
+        } else if (strcmp(option, "--record") == 0) {
+            outOptions->recordPath = value;
+        } else if (strcmp(option, "--verify") == 0) {
+            outOptions->verifyTolerance = (int32_t)strtol(value, nullptr, 10);
+            if (outOptions->verifyTolerance < 0 || outOptions->verifyTolerance > 255) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return outOptions->frameCount && outOptions->width && outOptions->height;
+}
+
+static int64_t getPercentile(const std::vector<int64_t>& sorted, uint32_t percent) {
+    // Nearest-rank, the same as FrameProfiler
+    const size_t rank = (sorted.size() * percent + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
+
+static double toMillis(int64_t nanos) {
+    return nanos / 1000000.0;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, &options)) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FrameProfiler profiler;
+    ScreenshotWriter screenshotWriter;
+    if (options.screenshotDirectory) {
+        screenshotWriter.setDirectory(options.screenshotDirectory);
+    }
+    FrameRecorder frameRecorder;
+    ResourceTracker resourceTracker;
+    Renderer renderer(&profiler, &screenshotWriter, &frameRecorder, &resourceTracker);
+    renderer.setLatencyProfile(options.latencyProfile);
+    renderer.initializeHeadless(options.width, options.height, options.assetDirectory);
+    if (options.recordPath) {
+        renderer.startRecording(std::make_unique<RawFileSink>(options.recordPath),
+                                YuvFormat::kNv12);
+    }
+    if (options.verifyTolerance >= 0) {
+        renderer.setFrameVerification(true, (uint8_t)options.verifyTolerance);
+    }
+
+    static constexpr const VkSurfaceTransformFlagBitsKHR kTransforms[4] = {
+            VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR,
+            VK_SURFACE_TRANSFORM_ROTATE_90_BIT_KHR,
+            VK_SURFACE_TRANSFORM_ROTATE_180_BIT_KHR,
+            VK_SURFACE_TRANSFORM_ROTATE_270_BIT_KHR,
+    };
+
+    std::vector<int64_t> frameTimes(options.frameCount);
+    const int64_t startNanos = FrameProfiler::getNowNanos();
+    for (uint32_t i = 0; i < options.frameCount; i++) {
+        if (options.rotationInterval && i && i % options.rotationInterval == 0) {
+            // Like a rotated display, the surface extent swaps for 90 and 270 degrees
+            const uint32_t step = (i / options.rotationInterval) % 4;
+            const bool isSwapped = step % 2 != 0;
+            renderer.setHeadlessSurface(isSwapped ? options.height : options.width,
+                                        isSwapped ? options.width : options.height,
+                                        kTransforms[step]);
+        }
+        // Every rotation should produce the same upright screenshot
+        const uint32_t rotationFrame = options.rotationInterval ? i % options.rotationInterval : i;
+        if (options.screenshotDirectory && rotationFrame == 0) {
+            renderer.requestScreenshot();
+        }
+
+        const int64_t frameStartNanos = FrameProfiler::getNowNanos();
+        renderer.drawFrame();
+        frameTimes[i] = FrameProfiler::getNowNanos() - frameStartNanos;
+    }
+    const int64_t totalNanos = FrameProfiler::getNowNanos() - startNanos;
+    const MemoryAllocator::Stats memoryStats = renderer.getMemoryStats();
+    renderer.destroy();
+
+    if (options.csvPath) {
+        FILE* csv = fopen(options.csvPath, "w");
+        ASSERT(csv);
+        fprintf(csv, "frame,nanos\n");
+        for (uint32_t i = 0; i < options.frameCount; i++) {
+            fprintf(csv, "%u,%lld\n", i, (long long)frameTimes[i]);
+        }
+        fclose(csv);
+    }
+
+    std::vector<int64_t> sorted = frameTimes;
+    std::sort(sorted.begin(), sorted.end());
+    printf("frames: %u, seconds: %.3f, fps: %.1f\n", options.frameCount, totalNanos / 1e9,
+           options.frameCount * 1e9 / totalNanos);
+    printf("%-16s p50 %8.3fms  p95 %8.3fms  p99 %8.3fms  max %8.3fms\n", "Frame",
+           toMillis(getPercentile(sorted, 50)), toMillis(getPercentile(sorted, 95)),
+           toMillis(getPercentile(sorted, 99)), toMillis(sorted.back()));
+    if (options.recordPath) {
+        const FrameRecorder::Stats stats = frameRecorder.getStats();
+        printf("recorded: %u, dropped: %u\n", stats.recordedFrameCount, stats.droppedFrameCount);
+    }
+    printf("memory: %u allocations, %u blocks, %u dedicated, %.1f of %.1f MiB used\n",
+           memoryStats.allocationCount, memoryStats.blockCount,
+           memoryStats.dedicatedAllocationCount, memoryStats.usedBytes / 1048576.0,
+           memoryStats.allocatedBytes / 1048576.0);
+    // The renderer is destroyed by now, so anything still live has leaked
+    const ResourceTracker::Stats resourceStats = resourceTracker.getStats();
+    uint32_t leakCount = 0;
+    for (uint32_t i = 0; i < static_cast<uint32_t>(ResourceTracker::Resource::kCount); i++) {
+        printf("%-16s peak %4u  leaked %u\n",
+               ResourceTracker::getResourceName(static_cast<ResourceTracker::Resource>(i)),
+               resourceStats.counts[i].peak, resourceStats.counts[i].live);
+        leakCount += resourceStats.counts[i].live;
+    }
+    for (uint32_t i = 0; i < resourceStats.heapCount; i++) {
+        printf("heap %u: peak %.1f MiB, budget %.1f of %.1f MiB\n", i,
+               resourceStats.heaps[i].peakAllocatedBytes / 1048576.0,
+               resourceStats.heaps[i].budgetBytes / 1048576.0,
+               resourceStats.heaps[i].size / 1048576.0);
+    }
+    // Frames still in flight when the renderer is destroyed aren't verified
+    const Renderer::VerificationStats verificationStats = renderer.getVerificationStats();
+    if (options.verifyTolerance >= 0) {
+        printf("verified: %u, mismatched: %u\n", verificationStats.verifiedFrameCount,
+               verificationStats.mismatchedFrameCount);
+    }
+
+    // Stage timings only cover the most recent frames kept by the profiler
+    for (uint32_t i = 0; i < static_cast<uint32_t>(FrameProfiler::Stage::kCount); i++) {
+        const auto stage = static_cast<FrameProfiler::Stage>(i);
+        const FrameProfiler::Summary summary = profiler.getSummary(stage);
+        if (summary.sampleCount == 0) {
+            continue;
+        }
+        printf("%-16s p50 %8.3fms  p95 %8.3fms  p99 %8.3fms  max %8.3fms\n",
+               FrameProfiler::getStageName(stage), toMillis(summary.p50Nanos),
+               toMillis(summary.p95Nanos), toMillis(summary.p99Nanos), toMillis(summary.maxNanos));
+    }
+
+    return verificationStats.mismatchedFrameCount || leakCount ? EXIT_FAILURE : EXIT_SUCCESS;
+}